@@ -116,6 +116,12 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareData(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to point to the SyncedMemory data, which
+   *        must hold at least count() values -- useful in Net&s which let
+   *        blobs that are never needed at the same time share memory.
+   */
+  void ShareData(const shared_ptr<SyncedMemory>& data);
   /**
    * @brief Set the diff_ shared_ptr to point to the SyncedMemory holding the
    *        diff_ of Blob other -- useful in Layer&s which simply perform a copy
@@ -48,6 +48,7 @@ class BaseDataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
   int datum_channels() const { return datum_channels_; }
   int datum_height() const { return datum_height_; }
@@ -90,10 +91,16 @@ class BasePrefetchingDataLayer :
   // The thread's function
   virtual void InternalThreadEntry() {}
 
+  /// @brief The database keys of the records in the last batch output, for
+  ///        the layers which read a database.
+  inline const vector<string>& keys() const { return keys_; }
+
  protected:
   Blob<Dtype> prefetch_data_;
   Blob<Dtype> prefetch_label_;
   Blob<Dtype> prefetch_text_;
+  vector<string> prefetch_keys_;
+  vector<string> keys_;
 };
 
 template <typename Dtype>
@@ -112,6 +119,10 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline int MaxTopBlobs() const { return 2; }
 
+  /// @brief The number of records one pass over the database reads, counted
+  ///        through the layer's own database handles.
+  virtual int NumRecords();
+
  protected:
   virtual void InternalThreadEntry();
 
@@ -138,6 +149,8 @@ class NuswideDataLayer : public DataLayer<Dtype> {
   }
   virtual inline int MaxTopBlobs() const { return 3; }
 
+  virtual int NumRecords();
+
  protected:
   virtual void InternalThreadEntry();
   int text_dim_;
@@ -164,6 +177,7 @@ class DummyDataLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -199,6 +213,7 @@ class HDF5DataLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -241,6 +256,7 @@ class HDF5OutputLayer : public Layer<Dtype> {
   // TODO: no limit on the number of blobs
   virtual inline int ExactNumBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 0; }
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
   inline std::string file_name() const { return file_name_; }
 
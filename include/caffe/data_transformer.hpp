@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <vector>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -21,6 +23,19 @@ class DataTransformer {
 
   void InitRand();
 
+  /**
+   * @brief Switches Transform to per-channel mean subtraction.
+   *
+   * @param mean_values
+   *    One mean per channel. Once set, the mean argument of Transform is
+   *    ignored and each channel subtracts its constant instead of reading a
+   *    full mean image per pixel. An empty vector restores the default.
+   */
+  void set_mean_values(const vector<Dtype>& mean_values) {
+    mean_values_ = mean_values;
+  }
+  inline bool has_mean_values() const { return !mean_values_.empty(); }
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -31,6 +46,8 @@ class DataTransformer {
    * @param datum
    *    Datum containing the data to be transformed.
    * @param mean
+   *    Full mean image of the datum size; unused if per-channel mean values
+   *    have been set.
    * @param transformed_data
    *    This is meant to be the top blob's data. The transformed data will be
    *    written at the appropriate place within the blob's data.
@@ -43,7 +60,8 @@ class DataTransformer {
 
   // Tranformation parameters
   TransformationParameter param_;
-
+  // Per-channel means; when non-empty they replace the mean image.
+  vector<Dtype> mean_values_;
 
   shared_ptr<Caffe::RNG> rng_;
   Caffe::Phase phase_;
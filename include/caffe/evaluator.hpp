@@ -67,6 +67,19 @@ class Searcher{
    * @return similarity matrix for each query and data point
    */
   const T* Search(const T* db, int point_dim, Metric metric=kCosine);
+  /**
+   * Cross-modal search against db points.
+   * Like Search(const T*, int, Metric), but query points are taken from
+   * query_src (at the same query IDs) instead of from db, e.g. text features
+   * searching image features.
+   * @param query_src points of shape num_points_ x point_dim to pick queries
+   * from.
+   * @param db  database points of shape num_points_ x point_dim.
+   * @param point_dim dimension of each point
+   * @return similarity matrix for each query and data point
+   */
+  const T* Search(const T* query_src, const T* db, int point_dim,
+      Metric metric=kCosine);
   /**
    * Calc MAP of the last search.
    * @param simmat similarity matrix for every query and data point, if null, use
@@ -75,10 +88,20 @@ class Searcher{
    * @return MAP score of last search
    */
   float GetMAP(const T* simmat, int topk=0);
+  /**
+   * Calc mean precision of the top k results of the last search.
+   * @param simmat similarity matrix, if null, use the sim matrix from last
+   * search.
+   * @param topk number of top results to consider.
+   * @return precision@topk averaged over queries.
+   */
+  float GetPrecision(const T* simmat, int topk);
   /**
    * Cacl precison and recall of the last search.
+   * Precision is interpolated (max precision at any recall >= the level) at
+   * n evenly spaced recall levels from 0 to 1 and averaged over queries.
    * @param n number of values for precision/recall
-   * @return precision recall pairs.
+   * @return (precision, recall) pairs.
    */
   std::vector<std::pair<float, float> > GetPrecisionRecall(int n=11);
   /**
@@ -109,6 +132,14 @@ class Searcher{
    * Sum each row of a matrix.
    */
   T* SumRow(const T* mat, int nrow, int ncol);
+  /**
+   * Sort db points by similarity to one query, most similar first.
+   * @param sim similarity row of the query.
+   * @param topk only the first topk entries are sorted.
+   * @param ranked (similarity, point id) pairs.
+   */
+  void RankPoints(const T* sim, int topk,
+      std::vector<std::pair<T, int> >* ranked);
 
   /**
    * calc L2 norm of ponints by calling cblas.
@@ -190,6 +190,12 @@ class Layer {
     return LayerParameter_LayerType_Name(type());
   }
 
+  /**
+   * @brief Returns the name of the algorithm the layer picked for its current
+   *        inputs and mode, or an empty string if it has only one.
+   */
+  virtual inline string algorithm() const { return ""; }
+
   /**
    * @brief Returns the exact number of bottom blobs required by the layer,
    *        or -1 if no exact number is required.
@@ -269,6 +275,16 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether the Net may run this layer on a worker thread,
+   *        concurrently with the layers it does not depend on.
+   *
+   * Layers drawing from the Caffe RNG return false, so that their draws keep
+   * the order of the net on the thread running it, as do layers relying on
+   * libraries that are not thread-safe.
+   */
+  virtual inline bool AllowConcurrentRun() const { return true; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
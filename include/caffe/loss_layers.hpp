@@ -10,6 +10,11 @@
 #include "caffe/layer.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/multi_label.hpp"
+
+namespace evaluator {
+template <typename T> class Searcher;
+}  // namespace evaluator
 
 namespace caffe {
 
@@ -127,6 +132,10 @@ class PrecisionRecallLayer : public Layer<Dtype> {
   }
 
   int top_k_; // select labels with top k probabilities as predictions
+  /// the decoded label sets of bottom[1]
+  MultiLabel labels_;
+  /// the top_k_ (score, class) min-heap slots
+  vector<std::pair<Dtype, int> > heap_;
   int test_interval_;
   int train_iter_;
   string reps_folder_;
@@ -421,16 +430,89 @@ class WeightedEuclideanLossLayer : public LossLayer<Dtype> {
 
   Blob<Dtype> diff_;
 };
+/**
+ * @brief Measures retrieval quality: MAP@k and precision@k of searching a
+ *        database of embeddings accumulated over a whole TEST pass.
+ *
+ * bottom is either (embedding, label), searching each modality against itself,
+ * or (query embedding, database embedding, label) for cross-modal search,
+ * e.g., text queries against images. label is a multi-label blob; a query and
+ * a point are relevant if they share a label.
+ *
+ * The layer copies every batch into a buffer of num_batches x batch size rows
+ * (capped by max_points). At the num_batches-th forward it runs the search
+ * with num_queries random queries and outputs (MAP@top_k, precision@top_k);
+ * the other forwards output zeros. The values are scaled by num_batches, so
+ * that the solver's average over test_iter == num_batches shows the metric
+ * itself in the "Test net output" log; the solver and caffe test check that
+ * they run the net for exactly num_batches iterations.
+ */
+template <typename Dtype>
+class RetrievalMAPLayer : public Layer<Dtype> {
+ public:
+  explicit RetrievalMAPLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_RETRIEVAL_MAP;
+  }
+
+  virtual inline int ExactNumBottomBlobs() const { return -1; }
+  virtual inline int MinBottomBlobs() const { return 2; }
+  virtual inline int MaxBottomBlobs() const { return 3; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool AllowConcurrentRun() const { return false; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  /// @brief Not implemented -- RetrievalMAPLayer cannot be used as a loss.
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  int num_batches_;
+  int top_k_;
+  int num_queries_;
+  /// forwards seen and rows buffered since the last search
+  int batch_;
+  int num_points_;
+  /// accumulated query (cross-modal only), database and label rows
+  Blob<Dtype> query_buffer_;
+  Blob<Dtype> db_buffer_;
+  Blob<Dtype> label_buffer_;
+  shared_ptr<evaluator::Searcher<Dtype> > searcher_;
+};
+
+/**
+ * @brief Computes the cosine distance loss
+ *        @f$ E = \frac{1}{N} \sum\limits_{n=1}^N
+ *            \left(1 - \frac{a_n \cdot b_n}{||a_n|| \, ||b_n||}\right) @f$
+ *        between two sets of embeddings.
+ *
+ * Two optional bottoms of shape @f$ (N \times 1 \times 1 \times 1) @f$ hold
+ * per-example losses of the branches producing @f$ a @f$ and @f$ b @f$. If
+ * given, only the branch with the larger loss of each pair receives a
+ * gradient, pulling it towards the other one.
+ */
 template <typename Dtype>
 class DotLossLayer : public LossLayer<Dtype> {
  public:
   explicit DotLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param), nrma_(), nrmb_() {}
+      : LossLayer<Dtype>(param), nrma_(), nrmb_(), cos_() {}
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
-    return LayerParameter_LayerType_EUCLIDEAN_LOSS;
+    return LayerParameter_LayerType_DOT_LOSS;
   }
 
   virtual inline int ExactNumBottomBlobs() const { return -1; }
@@ -438,21 +520,87 @@ class DotLossLayer : public LossLayer<Dtype> {
   virtual inline int MaxBottomBlobs() const { return 4; }
 
   /**
-   * Unlike most loss layers, in the EuclideanLossLayer we can backpropagate
-   * to both inputs -- override to return true and always allow force_backward.
+   * Like the EuclideanLossLayer, the DotLossLayer can backpropagate to both
+   * embedding inputs -- override to return true and always allow
+   * force_backward.
    */
+  virtual inline bool AllowForceBackward(const int bottom_index) const {
+    return bottom_index < 2;
+  }
+
+ protected:
+  /// @brief Computes both norms and the dot product of each pair in one pass.
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  /**
+   * @brief Computes the exact cosine gradient
+   *        @f$ \frac{\partial E}{\partial a_n} = \frac{1}{N} \left(
+   *            \frac{\cos_n}{||a_n||^2} a_n - \frac{b_n}{||a_n|| \, ||b_n||}
+   *        \right) @f$
+   *        (and symmetrically for @f$ b_n @f$) from the cached norms and
+   *        cosines.
+   */
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// per-example norms of a and b, and their cosine similarity
+  Blob<Dtype> nrma_, nrmb_, cos_;
+};
+
+/**
+ * @brief Computes an in-batch contrastive (InfoNCE) loss between two
+ *        modalities, using every other example of the batch as a negative.
+ *
+ * With @f$ S = \hat{a} \hat{b}^\top / \tau @f$ the N x N similarities of
+ * the (L2-normalized, if infonce_param.normalize) embeddings, computed with
+ * one GEMM, the loss is the cross entropy of matching each a_n to b_n among
+ * all of b, and each b_n to a_n among all of a:
+ * @f$ E = \frac{1}{2N} \sum\limits_{n=1}^N \left(
+ *     -\log \frac{e^{S_{nn}}}{\sum_m e^{S_{nm}}}
+ *     -\log \frac{e^{S_{nn}}}{\sum_m e^{S_{mn}}} \right) @f$.
+ *
+ * bottom[0] and bottom[1] are the N x D embeddings of the two modalities,
+ * e.g., fc8-image and fc2-text; row n of both describes the same item.
+ */
+template <typename Dtype>
+class InfoNCELossLayer : public LossLayer<Dtype> {
+ public:
+  explicit InfoNCELossLayer(const LayerParameter& param)
+      : LossLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_INFONCE_LOSS;
+  }
+
+  /// Both bottoms are embeddings, so both can be backpropagated to.
   virtual inline bool AllowForceBackward(const int bottom_index) const {
     return true;
   }
 
  protected:
-  /// @copydoc EuclideanLossLayer
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
-  Blob<Dtype> nrma_, nrmb_;
+  /// @brief Copies the rows of in to out, L2-normalized if normalize_.
+  void Normalize(const Blob<Dtype>& in, Blob<Dtype>* norm, Blob<Dtype>* out);
+
+  Dtype temperature_;
+  bool normalize_;
+  /// the (normalized) embeddings and their norms
+  Blob<Dtype> a_, b_, nrma_, nrmb_;
+  /// N x N similarities, then the gradient of the loss w.r.t. them
+  Blob<Dtype> sim_;
 };
 
 /**
@@ -552,6 +700,7 @@ class RankHingeLossLayer : public LossLayer<Dtype> {
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_RANK_HINGE_LOSS;
   }
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
  protected:
   virtual inline int ExactNumBottomBlobs() const { return -1; }
@@ -561,13 +710,29 @@ class RankHingeLossLayer : public LossLayer<Dtype> {
 
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom, 
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
  
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  /// @brief Picks the negative of anchor i from row i of scores_.
+  int MineNegative(const vector<Blob<Dtype>*>& bottom, int i);
+  /// @brief Whether example k may serve as a negative for anchor i.
+  bool IsNegative(const vector<Blob<Dtype>*>& bottom, int i, int k);
+
   Dtype margin_;
+  /// label_dict vectors indexed by label id, L2-normalized at LayerSetUp.
   Blob<Dtype> label_vec_;
+  /// num x dim normalized label vector of every example in the batch.
+  Blob<Dtype> norm_label_;
+  /// the decoded label sets of bottom[1]
+  MultiLabel labels_;
+  /// num x num scores of every embedding against every label vector, used by
+  /// the HARDEST and SEMI_HARD negative mining.
+  Blob<Dtype> scores_;
 };
 
 /**
@@ -942,14 +1107,24 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   vector<Blob<Dtype>*> softmax_top_vec_;
 };
 
+/**
+ * @brief Computes the multinomial logistic loss averaged over all labels of
+ *        each example, @f$ E = -\frac{1}{N} \sum\limits_{n=1}^N
+ *        \frac{1}{|L_n|} \sum\limits_{l \in L_n} \log(\hat{p}_{n,l}) @f$.
+ *
+ * The softmax is fused into the loss: Forward only keeps the log-sum-exp of
+ * every row, and Backward recomputes @f$ \hat{p} @f$ from it straight into
+ * the bottom diff, so no probability blob is materialized. bottom[1] holds
+ * the label ids of each example padded with -1 (NuswideDataLayer's multi-label
+ * blob); they are decoded into a MultiLabel once per forward.
+ *
+ * An optional second top receives the loss of every example.
+ */
 template <typename Dtype>
 class SoftmaxMultiLabelLossLayer : public LossLayer<Dtype> {
  public:
   explicit SoftmaxMultiLabelLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param),
-        softmax_layer_(new SoftmaxLayer<Dtype>(param)) {}
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
+      : LossLayer<Dtype>(param) {}
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -966,19 +1141,27 @@ class SoftmaxMultiLabelLossLayer : public LossLayer<Dtype> {
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
-  /// The internal SoftmaxLayer used to map predictions to a distribution.
-  shared_ptr<SoftmaxLayer<Dtype> > softmax_layer_;
-  /// prob stores the output probability predictions from the SoftmaxLayer.
-  Blob<Dtype> prob_;
-  /// bottom vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_bottom_vec_;
-  /// top vector holder used in call to the underlying SoftmaxLayer::Forward
-  vector<Blob<Dtype>*> softmax_top_vec_;
-  vector<int> num_labels_;
+  /// @brief Decodes bottom[1] into labels_, checking every example has a
+  ///        label below dim.
+  void DecodeLabels(const Blob<Dtype>& label, const int dim);
+
+  /// log-sum-exp of the predictions of every example
+  Blob<Dtype> log_sum_exp_;
+  /// loss of every example
+  Blob<Dtype> row_loss_;
+  /// the decoded label sets of bottom[1]
+  MultiLabel labels_;
+  /// device copy of the CSR offsets and ids of labels_
+  Blob<int> label_offset_;
+  Blob<int> label_index_;
 };
 }  // namespace caffe
 
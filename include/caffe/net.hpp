@@ -11,6 +11,8 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/feature_cache.hpp"
 
 namespace caffe {
 
@@ -25,7 +27,7 @@ class Net {
  public:
   explicit Net(const NetParameter& param);
   explicit Net(const string& param_file);
-  virtual ~Net() {}
+  virtual ~Net();
 
   /// @brief Initialize a network with a NetParameter.
   void Init(const NetParameter& param);
@@ -140,6 +142,8 @@ class Net {
   inline vector<Blob<Dtype>*>& output_blobs() { return net_output_blobs_; }
   inline vector<int>& input_blob_indices() { return net_input_blob_indices_; }
   inline vector<int>& output_blob_indices() { return net_output_blob_indices_; }
+  /// @brief The number of layers whose top is cached per record
+  inline int num_feature_caches() const { return feature_caches_.size(); }
   bool has_blob(const string& blob_name);
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name);
   bool has_layer(const string& layer_name);
@@ -147,10 +151,16 @@ class Net {
 
   void set_debug_info(const bool value) { debug_info_ = value; }
 
+  /// @brief The host buffers taken from the system and from the pool while
+  ///        this net ran Forward and Backward; once the blobs have their
+  ///        steady-state shapes, iterations take none from the system.
+  inline size_t host_system_allocs() const { return host_system_allocs_; }
+  inline size_t host_pool_allocs() const { return host_pool_allocs_; }
+
   // Helpers for Init.
   /**
    * @brief Remove layers that the user specified should be excluded given the current
-   *        phase, level, and stage.
+   *        phase, level, and stage, and the feature caches this net does not use.
    */
   static void FilterNet(const NetParameter& param,
       NetParameter* param_filtered);
@@ -172,6 +182,42 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /**
+   * @brief Let the activations which are never needed at the same time share
+   *        memory, for nets that only run Forward.
+   */
+  void ShareActivations(const NetParameter& param);
+
+  /**
+   * @brief Find the frozen sub-graph behind each layer whose top is cached
+   *        per record, and open the caches.
+   */
+  void InitFeatureCaches(const NetParameter& param);
+  /// @brief Read the features of the batch a data layer just output from the
+  ///        caches it keys, noting the records they lack.
+  void GetCachedFeatures(const int cache_id);
+  /// @brief Add the features of the records a cache lacked to it.
+  void PutCachedFeatures(const int cache_id);
+
+  /**
+   * @brief Derive which layers depend on which from the memory they touch,
+   *        and start the worker threads.
+   */
+  void InitScheduler(const NetParameter& param);
+  /**
+   * @brief Run the forward pass of layers start to end, or the backward pass
+   *        of layers start down to end, on the worker threads as their
+   *        dependencies allow.
+   */
+  void RunScheduled(const int start, const int end, const bool forward);
+  /// @brief Run the forward or backward pass of a layer.
+  void RunLayer(const int layer_id, const bool forward);
+  /// @brief The loop of the worker threads.
+  void WorkerEntry();
+
+  /// @brief Add the host allocations made since before to this net's.
+  void CountHostAllocs(const HostMemoryStats& before);
+
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -224,6 +270,37 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether the activations share memory, which rules out Backward.
+  bool activations_shared_;
+  /// The later layers depending on each layer in forward, which each layer
+  /// depends on in backward, and the earlier layers each layer depends on in
+  /// forward.
+  vector<vector<int> > layer_successors_;
+  vector<vector<int> > layer_predecessors_;
+  /// The loss of each layer in the last forward pass run by RunScheduled.
+  vector<Dtype> layer_losses_;
+  /// The threads running the layers that may run concurrently, the layers
+  /// ready for them (-1 to exit) and the layers they are done with.
+  vector<shared_ptr<boost::thread> > workers_;
+  BlockingQueue<int> ready_layers_;
+  BlockingQueue<int> done_layers_;
+  /// The direction, mode and phase of the pass the workers are running.
+  bool workers_forward_;
+  Caffe::Brew workers_mode_;
+  Caffe::Phase workers_phase_;
+  /// The feature caches, the layer whose top each caches, the data layer
+  /// keying it, the features of the current batch read from it and the items
+  /// of the batch it lacks; the sub-graph is skipped when there are none.
+  vector<shared_ptr<FeatureCache<Dtype> > > feature_caches_;
+  vector<int> cache_layer_ids_;
+  vector<int> cache_source_ids_;
+  vector<shared_ptr<Blob<Dtype> > > cache_features_;
+  vector<vector<int> > cache_misses_;
+  /// The cache whose frozen sub-graph each layer is part of, or -1.
+  vector<int> layer_cache_ids_;
+  /// The host allocations made by Forward and Backward.
+  size_t host_system_allocs_;
+  size_t host_pool_allocs_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
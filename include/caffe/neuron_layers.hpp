@@ -176,6 +176,7 @@ class DropoutLayer : public NeuronLayer<Dtype> {
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_DROPOUT;
   }
+  virtual inline bool AllowConcurrentRun() const { return false; }
 
  protected:
   /**
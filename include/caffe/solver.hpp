@@ -91,6 +91,9 @@ class SGDSolver : public Solver<Dtype> {
   virtual void PreSolve();
   Dtype GetLearningRate();
   virtual void ComputeUpdateValue();
+  // Whether a parameter neither learns nor has a gradient, so that its update
+  // is zero and its diff and history need not be allocated.
+  bool IsFrozen(const int param_id);
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
   // history maintains the historical momentum data.
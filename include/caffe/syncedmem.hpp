@@ -21,14 +21,43 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// Blobs are reshaped all the time (test feature buffers, per-forward scratch
+// blobs), so freed buffers are kept in a pool by size class and handed out
+// again instead of going back to the system. The pool holds at most
+// kCaffeHostPoolLimit bytes by default; buffers freed beyond that go back to
+// the system. Every buffer is aligned to kCaffeHostAlignment bytes for SIMD
+// and BLAS.
+
+const size_t kCaffeHostAlignment = 64;
+const size_t kCaffeHostPoolLimit = size_t(1) << 30;
+
+void CaffeMallocHost(void** ptr, size_t size);
+void CaffeFreeHost(void* ptr);
+
+struct HostMemoryStats {
+  HostMemoryStats()
+      : system_allocs(0), pool_allocs(0), bytes_in_use(0), bytes_pooled(0) {}
+  // Buffers taken from the system and from the pool since the start.
+  size_t system_allocs;
+  size_t pool_allocs;
+  // Bytes held by live buffers and by freed buffers waiting in the pool.
+  size_t bytes_in_use;
+  size_t bytes_pooled;
+};
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
-}
+HostMemoryStats CaffeHostMemoryStats();
+// Backs buffers of 2MB and more with transparent huge pages where the
+// system supports them. Only affects buffers taken from the system later.
+void CaffeSetHostHugePages(bool enabled);
+// Bounds the bytes the pool keeps, returning the excess to the system.
+void CaffeSetHostPoolLimit(size_t bytes);
+// Returns the pooled buffers to the system.
+void CaffeReleaseHostPool();
 
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
-}
+// Returns at least size bytes of zeros, to read memory that was never written
+// from without allocating it. The buffer is shared and must not be written.
+const void* CaffeZerosHost(size_t size);
 
 
 /**
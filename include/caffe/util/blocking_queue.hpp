@@ -0,0 +1,64 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_H_
+#define CAFFE_UTIL_BLOCKING_QUEUE_H_
+
+#include <queue>
+
+#include "boost/thread.hpp"
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A FIFO queue safe for concurrent producers and consumers; pop()
+ *        blocks until an element is available.
+ */
+template <typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue() {}
+
+  void push(const T& t) {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.push(t);
+    }
+    condition_.notify_one();
+  }
+
+  T pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      condition_.wait(lock);
+    }
+    T t = queue_.front();
+    queue_.pop();
+    return t;
+  }
+
+  bool try_pop(T* t) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (queue_.empty()) {
+      return false;
+    }
+    *t = queue_.front();
+    queue_.pop();
+    return true;
+  }
+
+  size_t size() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return queue_.size();
+  }
+
+ private:
+  std::queue<T> queue_;
+  mutable boost::mutex mutex_;
+  boost::condition_variable condition_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_H_
@@ -0,0 +1,41 @@
+#ifndef CAFFE_UTIL_FEATURE_CACHE_H_
+#define CAFFE_UTIL_FEATURE_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "leveldb/db.h"
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Fixed-dimension feature rows keyed by the database key of the
+ *        record they were computed from, kept in memory or in a leveldb.
+ */
+template <typename Dtype>
+class FeatureCache {
+ public:
+  /// @brief Keeps the features in the leveldb source, created if missing,
+  ///        or in memory if source is empty.
+  FeatureCache(const string& source, const int dim);
+
+  /// @brief Copies the feature of key to feature; false if it is missing.
+  bool Get(const string& key, Dtype* feature);
+  void Put(const string& key, const Dtype* feature);
+
+  inline int dim() const { return dim_; }
+
+ protected:
+  int dim_;
+  map<string, vector<Dtype> > features_;
+  shared_ptr<leveldb::DB> db_;
+
+  DISABLE_COPY_AND_ASSIGN(FeatureCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FEATURE_CACHE_H_
@@ -0,0 +1,106 @@
+#ifndef CAFFE_UTIL_FEATURE_IO_H_
+#define CAFFE_UTIL_FEATURE_IO_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/// @brief Element type of a feature file payload.
+enum FeatureFileType {
+  FEATURE_FLOAT32,
+  FEATURE_FLOAT16
+};
+
+/// Bytes before the payload; a multiple of 64 so rows stay aligned.
+const int kFeatureFileHeaderSize = 128;
+
+/// @brief Converts to IEEE half precision, rounding to nearest even.
+uint16_t FloatToHalf(float value);
+/// @brief Converts IEEE half precision back to float (exact).
+float HalfToFloat(uint16_t value);
+
+/// @brief Whether filename starts like a feature (.npy) file.
+bool IsFeatureFile(const string& filename);
+
+/**
+ * @brief Streams fixed-dimension feature rows into a binary feature file.
+ *
+ * A feature file is a NumPy .npy file (format version 1.0). It has a short
+ * text header with the dtype ('<f4' or '<f2') and the (num, dim) shape. The
+ * header is padded so the contiguous row-major payload starts at byte
+ * kFeatureFileHeaderSize. Close() writes the row count into the header, so
+ * the total does not have to be known up front. Read the file with
+ * numpy.load(filename, mmap_mode='r') or with MappedFeatureFile.
+ */
+class FeatureFileWriter {
+ public:
+  FeatureFileWriter(const string& filename, const int dim,
+      const FeatureFileType type = FEATURE_FLOAT32);
+  ~FeatureFileWriter();
+
+  /// @brief Appends num rows of dim() values each.
+  template <typename Dtype>
+  void Write(const Dtype* rows, const int num);
+  /// @brief Finalizes the header and closes the file; called by the dtor.
+  void Close();
+
+  inline int num() const { return num_; }
+  inline int dim() const { return dim_; }
+
+ protected:
+  void WriteHeader();
+
+  string filename_;
+  FILE* file_;
+  int dim_;
+  int num_;
+  FeatureFileType type_;
+  // Conversion buffer for rows that are not stored as Dtype.
+  vector<float> float_buffer_;
+  vector<uint16_t> half_buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(FeatureFileWriter);
+};
+
+/**
+ * @brief Read-only memory mapping of a feature file.
+ *
+ * For float32 files data() points straight into the mapping, so a database of
+ * features can be handed to evaluator::Searcher::Search without being read or
+ * parsed. float16 files are expanded into an owned float buffer on the first
+ * call to data().
+ */
+class MappedFeatureFile {
+ public:
+  explicit MappedFeatureFile(const string& filename);
+  ~MappedFeatureFile();
+
+  inline int num() const { return num_; }
+  inline int dim() const { return dim_; }
+  inline FeatureFileType type() const { return type_; }
+  /// @brief num() x dim() row-major features.
+  const float* data();
+  /// @brief The raw payload, of type() elements.
+  inline const void* raw_data() const { return payload_; }
+
+ protected:
+  void* map_;
+  size_t map_size_;
+  const char* payload_;
+  int num_;
+  int dim_;
+  FeatureFileType type_;
+  vector<float> expanded_;
+
+  DISABLE_COPY_AND_ASSIGN(MappedFeatureFile);
+};
+
+}  // namespace caffe
+
+#endif   // CAFFE_UTIL_FEATURE_IO_H_
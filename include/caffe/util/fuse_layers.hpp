@@ -0,0 +1,21 @@
+#ifndef _CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define _CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with the layers that are redundant at inference folded
+// into their neighbours, so that they no longer take a pass of their own over
+// the activations:
+//  - a RELU is applied in the epilogue of the CONVOLUTION or INNER_PRODUCT
+//    producing its input, by moving its relu_param to that layer;
+//  - a DROPOUT, which is the identity in the TEST phase, is removed and
+//    consumers of its top read its bottom instead.
+// The layers and blobs that are folded away can no longer be looked up by
+// name, and the result is only equivalent to param in the TEST phase.
+void FuseLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -3,17 +3,20 @@
 
 namespace caffe {
 
+// ld_col is the distance between consecutive rows of data_col, which lets
+// the columns of several images sit side by side in one matrix; 0 means the
+// rows are packed, i.e., ld_col = height_col * width_col.
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, Dtype* data_col);
+    const int stride_w, Dtype* data_col, int ld_col = 0);
 
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, Dtype* data_im);
+    const int stride_w, Dtype* data_im, int ld_col = 0);
 
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int channels,
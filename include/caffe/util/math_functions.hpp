@@ -151,6 +151,15 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Rectifies y in place, scaling its negatives by negative_slope >= 0.
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* y);
+
+// Backpropagates dy through caffe_cpu_relu in place, given its output y.
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -257,6 +266,13 @@ void caffe_gpu_fabs(const int n, const Dtype* x, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype negative_slope, Dtype* y);
+
+template <typename Dtype>
+void caffe_gpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy);
+
 #define DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(name, operation) \
 template<typename Dtype> \
 __global__ void name##_kernel(const int n, const Dtype* x, Dtype* y) { \
@@ -0,0 +1,41 @@
+#ifndef CAFFE_UTIL_WINOGRAD_HPP_
+#define CAFFE_UTIL_WINOGRAD_HPP_
+
+namespace caffe {
+
+// Winograd's minimal filtering F(2x2, 3x3) for 3x3 convolution with stride 1
+// (Lavin and Gray, "Fast Algorithms for Convolutional Neural Networks").
+// Each 2x2 output tile is computed from a 4x4 input tile as
+//   Y = A' [(G g G') .* (B' d B)] A,
+// so the convolution becomes 16 independent GEMMs, one per position xi of
+// the 4x4 transformed tile, on 2.25x fewer multiplications than im2col.
+//
+// The transformed data are laid out as 16 matrices, one per xi:
+//   filters  U: 16 x num_output x channels
+//   inputs   V: 16 x channels x ld (tile t of the image at column t)
+//   products M: 16 x num_output x ld
+// so that M_xi = U_xi * V_xi.
+
+// Transforms num_output 3x3 filters over channels channels into U.
+template <typename Dtype>
+void winograd_filter_transform_cpu(const Dtype* weight, const int num_output,
+    const int channels, Dtype* U);
+
+// Transforms the tiles_h x tiles_w input tiles of an image into columns
+// [0, tiles_h * tiles_w) of V, whose rows are ld apart.
+template <typename Dtype>
+void winograd_input_transform_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int tiles_h, const int tiles_w, const int ld, Dtype* V);
+
+// Transforms columns [0, tiles_h * tiles_w) of M back to a num_output x
+// height_out x width_out image, dropping the outputs of the last tiles that
+// fall outside of it.
+template <typename Dtype>
+void winograd_output_transform_cpu(const Dtype* M, const int num_output,
+    const int tiles_h, const int tiles_w, const int ld, const int height_out,
+    const int width_out, Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINOGRAD_HPP_
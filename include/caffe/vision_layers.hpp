@@ -62,6 +62,12 @@ class ConvolutionLayer : public Layer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *  - images_per_gemm (\b optional, default 0). The number of images whose
+   *  columns the CPU implementation multiplies in one GEMM; 0 sizes the
+   *  batch automatically.
+   *  - cpu_algorithm (\b optional, default AUTO). IM2COL, GEMM_1X1 (1x1
+   *  kernels with stride 1 and no padding, without im2col) or WINOGRAD (3x3
+   *  kernels with stride 1, forward pass only) on CPU.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -73,6 +79,9 @@ class ConvolutionLayer : public Layer<Dtype> {
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_CONVOLUTION;
   }
+  virtual inline string algorithm() const {
+    return ConvolutionParameter_CPUAlgorithm_Name(cpu_algorithm_);
+  }
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
@@ -107,8 +116,25 @@ class ConvolutionLayer : public Layer<Dtype> {
   /// N_ is the spatial dimension of the output, the H x W, which are the last
   /// dimensions of the data and filter matrices.
   int N_;
+  /// images_per_gemm_ images are lowered side by side into col_buffer_, a
+  /// (K_ * group_) x (images_per_gemm_ * N_) matrix, on CPU; 1 on GPU.
+  int images_per_gemm_;
   Blob<Dtype> col_buffer_;
+  /// the output (and output diff) of a batch of images before it is
+  /// scattered to (gathered from) the per-image layout of the top
+  Blob<Dtype> top_buffer_;
   Blob<Dtype> bias_multiplier_;
+
+  /// @brief The F(2x2, 3x3) forward pass of bottom, on CPU.
+  void ForwardWinograd_cpu(const Blob<Dtype>& bottom, Blob<Dtype>* top);
+
+  /// the CPU algorithm picked in Reshape; IM2COL on GPU
+  ConvolutionParameter_CPUAlgorithm cpu_algorithm_;
+  /// the number of Winograd tiles along the height and width of an output
+  int tiles_h_, tiles_w_;
+  /// the transformed filters, input tiles and their products (see
+  /// caffe/util/winograd.hpp)
+  Blob<Dtype> winograd_weight_, winograd_input_, winograd_output_;
 };
 
 #ifdef USE_CUDNN
@@ -253,6 +279,8 @@ class LRNLayer : public Layer<Dtype> {
   // Fields used for normalization ACROSS_CHANNELS
   // scale_ stores the intermediate summing results
   Blob<Dtype> scale_;
+  // ratio_buffer_ is the scratch space of a spatial tile in the CPU backward
+  Blob<Dtype> ratio_buffer_;
 
   // Fields used for normalization WITHIN_CHANNEL
   shared_ptr<SplitLayer<Dtype> > split_layer_;
@@ -316,9 +344,38 @@ class PoolingLayer : public Layer<Dtype> {
   int pad_h_, pad_w_;
   int channels_;
   int height_, width_;
+  /// @brief Whether the max pooling mask is kept as window offsets.
+  inline bool use_compact_mask(const vector<Blob<Dtype>*>& top) const {
+    return this->layer_param_.pooling_param().compact_mask() &&
+        top.size() == 1;
+  }
+  /**
+   * @brief Whether Forward_cpu pools a row of windows at a time: windows
+   *        without padding that leave no rows or columns out, and for max
+   *        pooling few enough to address in 8-bit offsets.
+   */
+  inline bool use_separable() const {
+    return pad_h_ == 0 && pad_w_ == 0 &&
+        stride_h_ <= kernel_h_ && stride_w_ <= kernel_w_ &&
+        (this->layer_param_.pooling_param().pool() !=
+         PoolingParameter_PoolMethod_MAX || kernel_h_ * kernel_w_ <= 256);
+  }
+  /**
+   * @brief Pools one channel without padding as a pass over the rows of the
+   *        windows and one over their columns, which run along contiguous
+   *        rows. Max pooling writes the argmax as window offsets.
+   */
+  void MaxPoolSeparable_cpu(const Dtype* bottom_data, Dtype* top_data,
+      uint8_t* offset);
+  void AvePoolSeparable_cpu(const Dtype* bottom_data, Dtype* top_data);
+
   int pooled_height_, pooled_width_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  /// the argmax as offsets within the windows, on CPU
+  shared_ptr<SyncedMemory> max_offset_;
+  /// a row of the separable CPU path, see MaxPoolSeparable_cpu
+  Blob<Dtype> row_buffer_;
 };
 
 #ifdef USE_CUDNN
@@ -58,6 +58,10 @@ const Dtype* Blob<Dtype>::gpu_data() const {
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_diff() const {
   CHECK(diff_);
+  // A diff is only allocated once written; until then it reads as zeros.
+  if (diff_->head() == SyncedMemory::UNINITIALIZED) {
+    return static_cast<const Dtype*>(CaffeZerosHost(count_ * sizeof(Dtype)));
+  }
   return (const Dtype*)diff_->cpu_data();
 }
 
@@ -97,6 +101,12 @@ void Blob<Dtype>::ShareData(const Blob& other) {
   data_ = other.data();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareData(const shared_ptr<SyncedMemory>& data) {
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+}
+
 template <typename Dtype>
 void Blob<Dtype>::ShareDiff(const Blob& other) {
   CHECK_EQ(count_, other.count());
@@ -111,6 +121,10 @@ template <> void Blob<int>::Update() { NOT_IMPLEMENTED; }
 
 template <typename Dtype>
 void Blob<Dtype>::Update() {
+  // A diff never written is all zeros, which leaves the data as it is.
+  if (diff_->head() == SyncedMemory::UNINITIALIZED) {
+    return;
+  }
   // We will perform update based on where the data is located.
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
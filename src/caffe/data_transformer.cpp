@@ -26,6 +26,12 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
                << "set at the same time.";
   }
 
+  const bool per_channel = has_mean_values();
+  if (per_channel) {
+    CHECK_EQ(mean_values_.size(), channels)
+        << "Expected one mean value per channel";
+  }
+
   if (crop_size) {
     CHECK(data.size()) << "Image cropping only support uint8 data";
     int h_off, w_off;
@@ -37,50 +43,64 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
       h_off = (height - crop_size) / 2;
       w_off = (width - crop_size) / 2;
     }
-    if (mirror && Rand() % 2) {
-      // Copy mirrored version
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
+    // A mirrored row is written right to left.
+    const bool do_mirror = mirror && Rand() % 2;
+    const int w_step = do_mirror ? -1 : 1;
+    for (int c = 0; c < channels; ++c) {
+      const Dtype channel_mean = per_channel ? mean_values_[c] : Dtype(0);
+      for (int h = 0; h < crop_size; ++h) {
+        const int data_offset = (c * height + h + h_off) * width + w_off;
+        const uint8_t* data_row =
+            reinterpret_cast<const uint8_t*>(data.data()) + data_offset;
+        Dtype* top_row = transformed_data
+            + ((batch_item_id * channels + c) * crop_size + h) * crop_size
+            + (do_mirror ? crop_size - 1 : 0);
+        if (per_channel) {
           for (int w = 0; w < crop_size; ++w) {
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + (crop_size - 1 - w);
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
+            top_row[w * w_step] =
+                (static_cast<Dtype>(data_row[w]) - channel_mean) * scale;
           }
-        }
-      }
-    } else {
-      // Normal copy
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
+        } else {
+          const Dtype* mean_row = mean + data_offset;
           for (int w = 0; w < crop_size; ++w) {
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + w;
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
+            top_row[w * w_step] =
+                (static_cast<Dtype>(data_row[w]) - mean_row[w]) * scale;
           }
         }
       }
     }
   } else {
+    Dtype* top_data = transformed_data + batch_item_id * size;
+    const int spatial_size = height * width;
     // we will prefer to use data() first, and then try float_data()
     if (data.size()) {
-      for (int j = 0; j < size; ++j) {
-        Dtype datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[j]));
-        transformed_data[j + batch_item_id * size] =
-            (datum_element - mean[j]) * scale;
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+      if (per_channel) {
+        for (int c = 0; c < channels; ++c) {
+          const Dtype channel_mean = mean_values_[c];
+          const int offset = c * spatial_size;
+          for (int j = offset; j < offset + spatial_size; ++j) {
+            top_data[j] = (static_cast<Dtype>(bytes[j]) - channel_mean) * scale;
+          }
+        }
+      } else {
+        for (int j = 0; j < size; ++j) {
+          top_data[j] = (static_cast<Dtype>(bytes[j]) - mean[j]) * scale;
+        }
       }
     } else {
-      for (int j = 0; j < size; ++j) {
-        transformed_data[j + batch_item_id * size] =
-            (datum.float_data(j) - mean[j]) * scale;
+      if (per_channel) {
+        for (int c = 0; c < channels; ++c) {
+          const Dtype channel_mean = mean_values_[c];
+          const int offset = c * spatial_size;
+          for (int j = offset; j < offset + spatial_size; ++j) {
+            top_data[j] = (datum.float_data(j) - channel_mean) * scale;
+          }
+        }
+      } else {
+        for (int j = 0; j < size; ++j) {
+          top_data[j] = (datum.float_data(j) - mean[j]) * scale;
+        }
       }
     }
   }
@@ -4,18 +4,21 @@
 #include <algorithm>
 #include "caffe/evaluator.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_label.hpp"
 
 namespace evaluator {
 template<typename T>
 Searcher<T>::~Searcher(){
+  if(query_id_!=NULL)
+    delete[] query_id_;
   if(query_!=NULL)
-    delete query_;
+    delete[] query_;
   if(sim_!=NULL)
-    delete sim_;
+    delete[] sim_;
   if(gndmat_!=NULL)
-    delete gndmat_;
+    delete[] gndmat_;
   if(num_relevant_!=NULL)
-    delete num_relevant_;
+    delete[] num_relevant_;
 }
 
 template<typename T>
@@ -32,6 +35,8 @@ template<typename T>
 Searcher<T>::Searcher(int num_queries, int num_points, int label_dim, 
     const T* label){
   assert(num_queries<num_points);
+  point_dim_=num_points_=num_queries_=0;
+  query_id_=NULL;
   query_=NULL;
   sim_=NULL;
   gndmat_=NULL;
@@ -42,7 +47,7 @@ Searcher<T>::Searcher(int num_queries, int num_points, int label_dim,
 template<typename T>
 void Searcher<T>::GenQueryIDs(int num_queries, int num_points){
   if(query_id_!=NULL)
-    delete query_id_;
+    delete[] query_id_;
   query_id_= new int[num_queries];
   caffe::caffe_rng_int_uniform(num_queries, 0, num_points-1, query_id_);
   num_queries_=num_queries;
@@ -51,16 +56,22 @@ void Searcher<T>::GenQueryIDs(int num_queries, int num_points){
 template<typename T>
 void Searcher<T>::SetupGroundTruth(int num_queries, int num_points,
     int label_dim, const T *label){
-  num_points_=num_points;
-  if(num_queries_!=num_queries_){
+  // query ids must be regenerated if they may fall outside the db
+  if(query_id_==NULL||num_queries_!=num_queries||num_points_!=num_points){
     GenQueryIDs(num_queries, num_points);
+    // the query and similarity buffers are sized by the old shape
+    delete[] query_;
+    query_=NULL;
+    delete[] sim_;
+    sim_=NULL;
   }
+  num_points_=num_points;
   num_queries_=num_queries;
   if(gndmat_!=NULL)
-    delete gndmat_;
+    delete[] gndmat_;
   gndmat_=CreateGroundTruthMatrix(query_id_, label, num_points_, label_dim);
   if(num_relevant_!=NULL)
-    delete num_relevant_;
+    delete[] num_relevant_;
   num_relevant_=SumRow(gndmat_, num_queries_, num_points_);
 }
 /**
@@ -73,40 +84,36 @@ T* Searcher<T>::CreateGroundTruthMatrix(const int* query_id,
                                         int label_dim){
   // generate ground truth matrix
   int num_queries=num_queries_;
-  int maxlabelidx=myblas_iamax(label_dim*num_points, label, 1);
-  // binary label
-  int blabel_dim=label[maxlabelidx]+1;
-  T* query_label=new T[num_queries*blabel_dim];
-  memset(query_label, 0, sizeof(int)*num_queries*blabel_dim);
-  for(int i=0;i<num_queries;i++){
-    int j=0;
-    int lb=label[query_id[i]*label_dim+j];
-    while(lb!=-1&&j<label_dim){
-      query_label[i*blabel_dim+lb]=1;
-      j++;
-      lb=label[query_id_[i]*label_dim+j];
-    }
+  caffe::MultiLabel labels;
+  labels.FromPadded(label, num_points, label_dim);
+  T* gndmat=new T[num_queries*num_points];
+  if(labels.has_mask()){
+    // few classes: AND the label masks directly
+    for(int i=0;i<num_queries;i++)
+      for(int j=0;j<num_points;j++)
+        gndmat[i*num_points+j]=labels.Shares(query_id[i], j)?1.0f:0.0f;
+    return gndmat;
   }
+  // binary label matrices, multiplied to count the shared labels
+  int blabel_dim=labels.num_classes();
+  T* query_label=new T[num_queries*blabel_dim];
+  memset(query_label, 0, sizeof(T)*num_queries*blabel_dim);
+  for(int i=0;i<num_queries;i++)
+    for(int k=0;k<labels.size(query_id[i]);k++)
+      query_label[i*blabel_dim+labels.labels(query_id[i])[k]]=1;
   T* db_label=new T[num_points*blabel_dim];
-  memset(db_label, 0, sizeof(int)*num_points*blabel_dim);
-  for(int i=0;i<num_points;i++){
-    int j=0;
-    int lb=label[i*label_dim+j];
-    while(lb!=-1&&j<label_dim){
-      db_label[i*blabel_dim+lb]=1;
-      j++;
-      lb=label[i*label_dim+j];
-    }
-  }
-  T* gndmat=new T[num_queries*num_points];
+  memset(db_label, 0, sizeof(T)*num_points*blabel_dim);
+  for(int i=0;i<num_points;i++)
+    for(int k=0;k<labels.size(i);k++)
+      db_label[i*blabel_dim+labels.labels(i)[k]]=1;
   myblas_gemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_queries, num_points,
       blabel_dim, 1.0f, query_label, blabel_dim, db_label, blabel_dim,
       0.0f, gndmat, num_points);
   for(int i=0;i<num_points*num_queries;i++)
     gndmat[i]=gndmat[i]>0.0f?1.0f:0.0f;
 
-  delete db_label;
-  delete query_label;
+  delete[] db_label;
+  delete[] query_label;
   return gndmat;
 }
 
@@ -119,12 +126,23 @@ T* Searcher<T>::SumRow(const T* mat, int nrow, int ncol){
     one[i]=1.0f;
   myblas_gemv(CblasRowMajor, CblasNoTrans, nrow, ncol, 1.0f, mat, ncol,
       one,1, 0.0f, sum, 1);
-  delete one;
+  delete[] one;
   return sum;
 }
 
 template<typename T>
 const T* Searcher<T>::Search(const T* db, int point_dim, Metric metric){
+  return Search(db, db, point_dim, metric);
+}
+
+template<typename T>
+const T* Searcher<T>::Search(const T* query_src, const T* db, int point_dim,
+    Metric metric){
+  CHECK(query_id_!=NULL)<<"Setup the ground truth before searching";
+  if(point_dim!=point_dim_&&query_!=NULL){
+    delete[] query_;
+    query_=NULL;
+  }
   point_dim_=point_dim;
   if(query_==NULL)
     query_=new T[num_queries_*point_dim_];
@@ -132,7 +150,7 @@ const T* Searcher<T>::Search(const T* db, int point_dim, Metric metric){
     sim_=new T[num_queries_*num_points_];
   // prepare query points
   for(int i=0;i<num_queries_;i++){
-    memcpy(query_+i*point_dim_, db+query_id_[i]*point_dim_,
+    memcpy(query_+i*point_dim_, query_src+query_id_[i]*point_dim_,
         sizeof(T)*point_dim_);
   }
   if(metric==kCosine){
@@ -153,8 +171,8 @@ const T* Searcher<T>::Search(const T* db, int point_dim, Metric metric){
       for(int j=0;j<num_points_;j++)
         sim_[k++]/=query_nrm2[i]*db_nrm2[j];
     }
-    delete query_nrm2;
-    delete db_nrm2;
+    delete[] query_nrm2;
+    delete[] db_nrm2;
   }else{
     std::cout<<"ERROR:Not implemented for metric other than cosine";
   }
@@ -164,26 +182,35 @@ const T* Searcher<T>::Search(const T* db, int point_dim, Metric metric){
 template<typename T>
 const T* Searcher<T>::Search(const T* db, int num_points, int point_dim,
     int num_queries, const T* label, int label_dim, Metric metric){
-  if(point_dim!=point_dim_||num_queries!=num_queries_){
-    point_dim_=point_dim;
-    if(query_!=NULL){
-      delete query_;
-      query_=NULL;
-    }
+  if(num_queries!=num_queries_&&query_!=NULL){
+    delete[] query_;
+    query_=NULL;
   }
   if(num_queries!=num_queries_||num_points!=num_points_){
     if(sim_!=NULL){
-      delete sim_;
+      delete[] sim_;
       sim_=NULL;
     }
-    num_queries_=num_queries;
-    num_points_=num_points;
   }
   if(label!=NULL)
     SetupGroundTruth(num_queries, num_points, label_dim, label);
+  else
+    CHECK(num_queries==num_queries_&&num_points==num_points_)
+      <<"A new label matrix is needed for a different num_points/num_queries";
   return Search(db, point_dim,  metric);
 }
 
+template<typename T>
+void Searcher<T>::RankPoints(const T* sim, int topk,
+    std::vector<std::pair<T, int> >* ranked){
+  ranked->clear();
+  ranked->reserve(num_points_);
+  for(int j=0;j<num_points_;j++)
+    ranked->push_back(std::make_pair(sim[j], j));
+  std::partial_sort(ranked->begin(), ranked->begin()+topk,
+      ranked->end(), std::greater<std::pair<T, int> >());
+}
+
 template<typename T>
 float Searcher<T>::GetMAP(const T* simmat, int topk) {
   assert(gndmat_!=NULL);
@@ -199,13 +226,9 @@ float Searcher<T>::GetMAP(const T* simmat, int topk) {
   float map=0.0f;
   if(topk==0)
     topk=num_points_;
+  std::vector<std::pair<T, int> > sim;
   for(size_t i=0;i<num_queries_;i++){
-    std::vector<std::pair<T, int> > sim;
-    for(int j=0;j<num_points_;j++)
-      sim.push_back(std::make_pair(mat[i*num_points_+j], j));
-
-    std::partial_sort(sim.begin(), sim.begin()+topk,
-        sim.end(), std::greater<std::pair<T, int> >());
+    RankPoints(mat+i*num_points_, topk, &sim);
 
     T *gnd=gndmat_+i*num_points_;
     float hits=0.0f, score=0.0f;
@@ -220,6 +243,70 @@ float Searcher<T>::GetMAP(const T* simmat, int topk) {
   }
   return map/num_queries_;
 }
+
+template<typename T>
+float Searcher<T>::GetPrecision(const T* simmat, int topk) {
+  CHECK(gndmat_!=NULL);
+  const T* mat=simmat==NULL?sim_:simmat;
+  CHECK(mat!=NULL);
+  CHECK_GT(topk, 0);
+  topk=std::min(topk, num_points_);
+  float precision=0.0f;
+  std::vector<std::pair<T, int> > sim;
+  for(int i=0;i<num_queries_;i++){
+    RankPoints(mat+i*num_points_, topk, &sim);
+    const T *gnd=gndmat_+i*num_points_;
+    int hits=0;
+    for(int j=0;j<topk;j++)
+      if(gnd[sim[j].second]>0)
+        hits++;
+    precision+=hits*1.0f/topk;
+  }
+  return precision/num_queries_;
+}
+
+template<typename T>
+std::vector<std::pair<float, float> > Searcher<T>::GetPrecisionRecall(int n) {
+  CHECK(gndmat_!=NULL);
+  CHECK(sim_!=NULL);
+  CHECK_GT(n, 1);
+  std::vector<float> precision(n, 0.0f);
+  std::vector<std::pair<T, int> > sim;
+  std::vector<float> level_precision(n);
+  for(int i=0;i<num_queries_;i++){
+    RankPoints(sim_+i*num_points_, num_points_, &sim);
+    const T *gnd=gndmat_+i*num_points_;
+    // walk the ranking backwards so the running max is the interpolated
+    // precision at every recall >= the current one
+    int hits=0;
+    for(int j=0;j<num_points_;j++)
+      if(gnd[sim[j].second]>0)
+        hits++;
+    const float num_relevant=hits;
+    std::fill(level_precision.begin(), level_precision.end(), 0.0f);
+    float max_precision=0.0f;
+    int level=n-1;
+    for(int j=num_points_-1;j>=0&&num_relevant>0;j--){
+      max_precision=std::max(max_precision, hits/(j+1.0f));
+      if(gnd[sim[j].second]>0)
+        hits--;
+      // levels above the recall of the previous rank are first reached here
+      const float prev_recall=hits/num_relevant;
+      while(level>=0&&level/(n-1.0f)>prev_recall)
+        level_precision[level--]=max_precision;
+    }
+    // recall 0 is reached before the first hit
+    while(level>=0)
+      level_precision[level--]=max_precision;
+    for(int k=0;k<n;k++)
+      precision[k]+=level_precision[k];
+  }
+  std::vector<std::pair<float, float> > curve;
+  for(int k=0;k<n;k++)
+    curve.push_back(std::make_pair(precision[k]/num_queries_, k/(n-1.0f)));
+  return curve;
+}
+
 template<>
 void Searcher<float>::myblas_gemm(const enum CBLAS_ORDER Order,
                    const enum CBLAS_TRANSPOSE TransA,
@@ -219,6 +219,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new Im2colLayer<Dtype>(param);
   case LayerParameter_LayerType_INFOGAIN_LOSS:
     return new InfogainLossLayer<Dtype>(param);
+  case LayerParameter_LayerType_INFONCE_LOSS:
+    return new InfoNCELossLayer<Dtype>(param);
   case LayerParameter_LayerType_INNER_PRODUCT:
     return new InnerProductLayer<Dtype>(param);
   case LayerParameter_LayerType_NUSWIDE_DATA:
@@ -241,6 +243,8 @@ Layer<Dtype>* GetLayer(const LayerParameter& param) {
     return new PrecisionRecallLayer<Dtype>(param);
   case LayerParameter_LayerType_RELU:
     return GetReLULayer<Dtype>(name, param);
+  case LayerParameter_LayerType_RETRIEVAL_MAP:
+    return new RetrievalMAPLayer<Dtype>(param);
   case LayerParameter_LayerType_SILENCE:
     return new SilenceLayer<Dtype>(param);
   case LayerParameter_LayerType_SIGMOID:
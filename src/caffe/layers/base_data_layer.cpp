@@ -31,6 +31,10 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GE(datum_width_, transform_param_.crop_size());
   }
   // check if we want to have mean
+  CHECK(!(transform_param_.has_mean_file() &&
+          transform_param_.mean_value_size() > 0))
+      << "Specify either mean_file or mean_value, not both";
+  vector<Dtype> mean_values;
   if (transform_param_.has_mean_file()) {
     const string& mean_file = transform_param_.mean_file();
     LOG(INFO) << "Loading mean file from" << mean_file;
@@ -39,12 +43,32 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     data_mean_.FromProto(blob_proto);
     CHECK_GE(data_mean_.num(), 1);
     CHECK_GE(data_mean_.channels(), datum_channels_);
-    CHECK_GE(data_mean_.height(), datum_height_);
-    CHECK_GE(data_mean_.width(), datum_width_);
+    if (data_mean_.height() == 1 && data_mean_.width() == 1) {
+      // A per-channel mean, as written by compute_image_mean --per_channel.
+      const Dtype* channel_mean = data_mean_.cpu_data();
+      mean_values.assign(channel_mean, channel_mean + datum_channels_);
+    } else {
+      CHECK_GE(data_mean_.height(), datum_height_);
+      CHECK_GE(data_mean_.width(), datum_width_);
+    }
+  } else if (transform_param_.mean_value_size() > 0) {
+    CHECK(transform_param_.mean_value_size() == 1 ||
+          transform_param_.mean_value_size() == datum_channels_)
+        << "Specify one mean_value or as many as the " << datum_channels_
+        << " channels";
+    for (int c = 0; c < datum_channels_; ++c) {
+      mean_values.push_back(transform_param_.mean_value(
+          transform_param_.mean_value_size() == 1 ? 0 : c));
+    }
+    data_mean_.Reshape(1, datum_channels_, 1, 1);
   } else {
     // Simply initialize an all-empty mean.
     data_mean_.Reshape(1, datum_channels_, datum_height_, datum_width_);
   }
+  if (!mean_values.empty()) {
+    LOG(INFO) << "Subtracting a per-channel mean";
+    data_transformer_.set_mean_values(mean_values);
+  }
   mean_ = data_mean_.cpu_data();
   data_transformer_.InitRand();
 }
@@ -61,7 +85,9 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
   if (this->output_labels_) {
     this->prefetch_label_.mutable_cpu_data();
   }
-  this->prefetch_text_.mutable_cpu_data();
+  if (this->prefetch_text_.count()) {
+    this->prefetch_text_.mutable_cpu_data();
+  }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
   DLOG(INFO) << "Prefetch initialized.";
@@ -84,6 +110,7 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   // First, join the thread
   JoinPrefetchThread();
+  keys_.swap(prefetch_keys_);
   // Copy the data
   caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
              (*top)[0]->mutable_cpu_data());
@@ -91,8 +118,10 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
                (*top)[1]->mutable_cpu_data());
   }
-  caffe_copy(prefetch_text_.count(), prefetch_text_.cpu_data(),
-             (*top)[2]->mutable_cpu_data());
+  if (top->size() > 2) {
+    caffe_copy(prefetch_text_.count(), prefetch_text_.cpu_data(),
+               (*top)[2]->mutable_cpu_data());
+  }
 
   // Start a new prefetch thread
   CreatePrefetchThread();
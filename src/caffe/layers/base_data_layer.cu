@@ -9,6 +9,7 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   // First, join the thread
   JoinPrefetchThread();
+  keys_.swap(prefetch_keys_);
   // Copy the data
   caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
       (*top)[0]->mutable_gpu_data());
@@ -16,8 +17,10 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
         (*top)[1]->mutable_gpu_data());
   }
-  caffe_copy(prefetch_text_.count(), prefetch_text_.cpu_data(),
-      (*top)[2]->mutable_gpu_data());
+  if (top->size() > 2) {
+    caffe_copy(prefetch_text_.count(), prefetch_text_.cpu_data(),
+        (*top)[2]->mutable_gpu_data());
+  }
 
   // Start a new prefetch thread
   CreatePrefetchThread();
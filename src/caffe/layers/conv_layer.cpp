@@ -1,13 +1,22 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/winograd.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// The column buffer size, in values, up to which images_per_gemm: 0 batches
+// images on CPU.
+static const int kAutoColBufferCount = 4 << 20;
+// The fewest input and output channels per group for which cpu_algorithm:
+// AUTO runs 3x3 convolutions as Winograd F(2x2, 3x3).
+static const int kAutoWinogradMinChannels = 16;
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -117,49 +126,179 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   M_ = num_output_ / group_;
   K_ = channels_ * kernel_h_ * kernel_w_ / group_;
   N_ = height_out_ * width_out_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage.
-  col_buffer_.Reshape(
-      1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  // Pick the CPU algorithm.
+  const bool is_1x1 = kernel_h_ == 1 && kernel_w_ == 1 &&
+      stride_h_ == 1 && stride_w_ == 1 && pad_h_ == 0 && pad_w_ == 0;
+  const bool is_3x3 = kernel_h_ == 3 && kernel_w_ == 3 &&
+      stride_h_ == 1 && stride_w_ == 1;
+  cpu_algorithm_ = this->layer_param_.convolution_param().cpu_algorithm();
+  if (Caffe::mode() == Caffe::GPU) {
+    cpu_algorithm_ = ConvolutionParameter_CPUAlgorithm_IM2COL;
+  } else if (cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_AUTO) {
+    if (is_1x1) {
+      cpu_algorithm_ = ConvolutionParameter_CPUAlgorithm_GEMM_1X1;
+    } else if (is_3x3 && K_ / 9 >= kAutoWinogradMinChannels &&
+        M_ >= kAutoWinogradMinChannels) {
+      cpu_algorithm_ = ConvolutionParameter_CPUAlgorithm_WINOGRAD;
+    } else {
+      cpu_algorithm_ = ConvolutionParameter_CPUAlgorithm_IM2COL;
+    }
+  }
+  CHECK(cpu_algorithm_ != ConvolutionParameter_CPUAlgorithm_GEMM_1X1 || is_1x1)
+      << "GEMM_1X1 needs a 1x1 kernel with stride 1 and no padding.";
+  CHECK(cpu_algorithm_ != ConvolutionParameter_CPUAlgorithm_WINOGRAD || is_3x3)
+      << "WINOGRAD needs a 3x3 kernel with stride 1.";
+  // The im2col result buffer holds images_per_gemm_ images side by side.
+  // The GPU implementation lowers one image at a time to avoid overly large
+  // memory usage; on CPU, a few images per GEMM keep BLAS efficient on small
+  // feature maps.
+  images_per_gemm_ = 1;
+  if (Caffe::mode() == Caffe::CPU) {
+    images_per_gemm_ =
+        this->layer_param_.convolution_param().images_per_gemm();
+    if (images_per_gemm_ == 0) {
+      images_per_gemm_ = std::max(1, kAutoColBufferCount / (K_ * group_ * N_));
+    }
+    images_per_gemm_ = std::min(images_per_gemm_, num_);
+  }
+  // The input of a 1x1 convolution already is its column matrix, so it is
+  // multiplied in place, one image at a time.
+  if (cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_GEMM_1X1) {
+    images_per_gemm_ = 1;
+  }
+  col_buffer_.Reshape(1, channels_ * kernel_h_ * kernel_w_, images_per_gemm_,
+      N_);
+  if (images_per_gemm_ > 1) {
+    top_buffer_.Reshape(1, num_output_, images_per_gemm_, N_);
+  }
+  if (cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_WINOGRAD) {
+    tiles_h_ = (height_out_ + 1) / 2;
+    tiles_w_ = (width_out_ + 1) / 2;
+    const int tiles = images_per_gemm_ * tiles_h_ * tiles_w_;
+    winograd_weight_.Reshape(16, num_output_, K_ / 9, 1);
+    winograd_input_.Reshape(16, channels_, 1, tiles);
+    winograd_output_.Reshape(16, num_output_, 1, tiles);
+  }
   for (int top_id = 0; top_id < top->size(); ++top_id) {
     (*top)[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
-    bias_multiplier_.Reshape(1, 1, 1, N_);
-    caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    bias_multiplier_.Reshape(1, 1, images_per_gemm_, N_);
+    caffe_set(bias_multiplier_.count(), Dtype(1),
+        bias_multiplier_.mutable_cpu_data());
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int weight_offset = M_ * K_;  // number of filter parameters in a group
+  const bool is_1x1 =
+      cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_GEMM_1X1;
   for (int i = 0; i < bottom.size(); ++i) {
+    if (cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_WINOGRAD) {
+      ForwardWinograd_cpu(*bottom[i], (*top)[i]);
+      continue;
+    }
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = (*top)[i]->mutable_cpu_data();
     Dtype* col_data = col_buffer_.mutable_cpu_data();
-    const Dtype* weight = this->blobs_[0]->cpu_data();
-    int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int col_offset = K_ * N_;  // number of values in an input region / column
-    int top_offset = M_ * N_;  // number of values in an output region / column
-    for (int n = 0; n < num_; ++n) {
+    for (int n = 0; n < num_; n += images_per_gemm_) {
+      const int batch = std::min(images_per_gemm_, num_ - n);
+      // the number of columns of the batch; column b * N_ + p holds the input
+      // region of output p of image n + b
+      const int cols = batch * N_;
       // im2col transformation: unroll input regions for filtering
       // into column matrix for multplication.
-      im2col_cpu(bottom_data + bottom[i]->offset(n), channels_, height_,
-          width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
-          col_data);
+      const Dtype* col = col_data;
+      if (is_1x1) {
+        col = bottom_data + bottom[i]->offset(n);
+      } else {
+        for (int b = 0; b < batch; ++b) {
+          im2col_cpu(bottom_data + bottom[i]->offset(n + b), channels_,
+              height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              stride_h_, stride_w_, col_data + b * N_, cols);
+        }
+      }
+      // A single image is written to the top in place; a batch is
+      // num_output_ x cols and has to be scattered afterwards.
+      Dtype* output = batch == 1 ? top_data + (*top)[i]->offset(n) :
+          top_buffer_.mutable_cpu_data();
       // Take inner products for groups.
       for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-          (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, cols, K_,
+          (Dtype)1., weight + weight_offset * g, col + K_ * cols * g,
+          (Dtype)0., output + M_ * cols * g);
       }
       // Add bias.
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+            cols, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            bias_multiplier_.cpu_data(), (Dtype)1., output);
+      }
+      // Rectify while the output is still in cache.
+      if (this->layer_param_.has_relu_param()) {
+        caffe_cpu_relu(num_output_ * cols,
+            Dtype(this->layer_param_.relu_param().negative_slope()), output);
+      }
+      if (batch > 1) {
+        for (int b = 0; b < batch; ++b) {
+          for (int c = 0; c < num_output_; ++c) {
+            caffe_copy(N_, output + c * cols + b * N_,
+                top_data + (*top)[i]->offset(n + b, c));
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ForwardWinograd_cpu(const Blob<Dtype>& bottom,
+      Blob<Dtype>* top) {
+  const int channels_g = channels_ / group_;
+  // The filters may have changed since the last pass.
+  Dtype* U = winograd_weight_.mutable_cpu_data();
+  winograd_filter_transform_cpu(this->blobs_[0]->cpu_data(), num_output_,
+      channels_g, U);
+  Dtype* V = winograd_input_.mutable_cpu_data();
+  Dtype* M = winograd_output_.mutable_cpu_data();
+  const Dtype* bottom_data = bottom.cpu_data();
+  Dtype* top_data = top->mutable_cpu_data();
+  const int tiles = tiles_h_ * tiles_w_;
+  for (int n = 0; n < num_; n += images_per_gemm_) {
+    const int batch = std::min(images_per_gemm_, num_ - n);
+    // the tiles of the batch side by side, like the columns in Forward_cpu
+    const int cols = batch * tiles;
+    for (int b = 0; b < batch; ++b) {
+      winograd_input_transform_cpu(bottom_data + bottom.offset(n + b),
+          channels_, height_, width_, pad_h_, pad_w_, tiles_h_, tiles_w_,
+          cols, V + b * tiles);
+    }
+    // One GEMM per tile position and group.
+    for (int xi = 0; xi < 16; ++xi) {
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, cols,
+            channels_g, (Dtype)1.,
+            U + (xi * num_output_ + g * M_) * channels_g,
+            V + (xi * channels_ + g * channels_g) * cols, (Dtype)0.,
+            M + (xi * num_output_ + g * M_) * cols);
+      }
+    }
+    for (int b = 0; b < batch; ++b) {
+      Dtype* output = top_data + top->offset(n + b);
+      winograd_output_transform_cpu(M + b * tiles, num_output_, tiles_h_,
+          tiles_w_, cols, height_out_, width_out_, output);
       if (bias_term_) {
         caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
             N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-            bias_multiplier_.cpu_data(),
-            (Dtype)1., top_data + (*top)[i]->offset(n));
+            bias_multiplier_.cpu_data(), (Dtype)1., output);
+      }
+      if (this->layer_param_.has_relu_param()) {
+        caffe_cpu_relu(num_output_ * N_,
+            Dtype(this->layer_param_.relu_param().negative_slope()), output);
       }
     }
   }
@@ -181,9 +320,15 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   const int weight_offset = M_ * K_;
-  const int col_offset = K_ * N_;
-  const int top_offset = M_ * N_;
+  const bool is_1x1 =
+      cpu_algorithm_ == ConvolutionParameter_CPUAlgorithm_GEMM_1X1;
   for (int i = 0; i < top.size(); ++i) {
+    // Backpropagate through the fused ReLU first.
+    if (this->layer_param_.has_relu_param()) {
+      caffe_cpu_relu_backward(top[i]->count(),
+          Dtype(this->layer_param_.relu_param().negative_slope()),
+          top[i]->cpu_data(), top[i]->mutable_cpu_diff());
+    }
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
     if (bias_term_ && this->param_propagate_down_[1]) {
@@ -203,18 +348,40 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       Dtype* col_diff = col_buffer_.mutable_cpu_diff();
       const Dtype* bottom_data = (*bottom)[i]->cpu_data();
       Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
-      for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        im2col_cpu(bottom_data + (*bottom)[i]->offset(n), channels_, height_,
-                   width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
-                   stride_h_, stride_w_, col_data);
+      for (int n = 0; n < num_; n += images_per_gemm_) {
+        const int batch = std::min(images_per_gemm_, num_ - n);
+        const int cols = batch * N_;
+        // Gather the top diff of a batch side by side, as Forward_cpu laid
+        // out its output.
+        const Dtype* output_diff = top_diff + top[i]->offset(n);
+        if (batch > 1) {
+          Dtype* buffer_diff = top_buffer_.mutable_cpu_diff();
+          for (int b = 0; b < batch; ++b) {
+            for (int c = 0; c < num_output_; ++c) {
+              caffe_copy(N_, top_diff + top[i]->offset(n + b, c),
+                  buffer_diff + c * cols + b * N_);
+            }
+          }
+          output_diff = buffer_diff;
+        }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
+          // Since we saved memory in the forward pass by not storing all col
+          // data, we will need to recompute them.
+          const Dtype* col = col_data;
+          if (is_1x1) {
+            col = bottom_data + (*bottom)[i]->offset(n);
+          } else {
+            for (int b = 0; b < batch; ++b) {
+              im2col_cpu(bottom_data + (*bottom)[i]->offset(n + b), channels_,
+                  height_, width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+                  stride_h_, stride_w_, col_data + b * N_, cols);
+            }
+          }
           for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_data + col_offset * g, (Dtype)1.,
+            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, cols,
+                (Dtype)1., output_diff + M_ * cols * g,
+                col + K_ * cols * g, (Dtype)1.,
                 weight_diff + weight_offset * g);
           }
         }
@@ -223,16 +390,21 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
           if (weight == NULL) {
             weight = this->blobs_[0]->cpu_data();
           }
+          // The column diff of a 1x1 convolution is the bottom diff.
+          Dtype* col = is_1x1 ? bottom_diff + (*bottom)[i]->offset(n) :
+              col_diff;
           for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, cols, M_,
                 (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_diff + col_offset * g);
+                output_diff + M_ * cols * g,
+                (Dtype)0., col + K_ * cols * g);
           }
           // col2im back to the data
-          col2im_cpu(col_diff, channels_, height_, width_,
-              kernel_h_, kernel_w_, pad_h_, pad_w_,
-              stride_h_, stride_w_, bottom_diff + (*bottom)[i]->offset(n));
+          for (int b = 0; !is_1x1 && b < batch; ++b) {
+            col2im_cpu(col_diff + b * N_, channels_, height_, width_,
+                kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+                bottom_diff + (*bottom)[i]->offset(n + b), cols);
+          }
         }
       }
     }
@@ -39,6 +39,11 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
             bias_multiplier_.gpu_data(),
             (Dtype)1., top_data + (*top)[i]->offset(n));
       }
+      if (this->layer_param_.has_relu_param()) {
+        caffe_gpu_relu(num_output_ * N_,
+            Dtype(this->layer_param_.relu_param().negative_slope()),
+            top_data + (*top)[i]->offset(n));
+      }
     }
   }
 }
@@ -63,6 +68,11 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const int col_offset = K_ * N_;
   const int top_offset = M_ * N_;
   for (int i = 0; i < top.size(); ++i) {
+    if (this->layer_param_.has_relu_param()) {
+      caffe_gpu_relu_backward(top[i]->count(),
+          Dtype(this->layer_param_.relu_param().negative_slope()),
+          top[i]->gpu_data(), top[i]->mutable_gpu_diff());
+    }
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
     if (bias_term_ && this->param_propagate_down_[1]) {
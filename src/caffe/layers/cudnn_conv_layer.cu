@@ -43,6 +43,10 @@ void CuDNNConvolutionLayer<Dtype>::Forward_gpu(
     // stream, by launching an empty kernel into the default (null) stream.
     // NOLINT_NEXT_LINE(whitespace/operators)
     sync_conv_groups<<<1, 1>>>();
+    if (this->layer_param_.has_relu_param()) {
+      caffe_gpu_relu((*top)[i]->count(),
+          Dtype(this->layer_param_.relu_param().negative_slope()), top_data);
+    }
   }
 }
 
@@ -62,6 +66,11 @@ void CuDNNConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     caffe_gpu_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
   for (int i = 0; i < top.size(); ++i) {
+    if (this->layer_param_.has_relu_param()) {
+      caffe_gpu_relu_backward(top[i]->count(),
+          Dtype(this->layer_param_.relu_param().negative_slope()),
+          top[i]->gpu_data(), top[i]->mutable_gpu_diff());
+    }
     const Dtype* top_diff = top[i]->gpu_diff();
     // Backward through cuDNN in parallel over groups and gradients.
     for (int g = 0; g < this->group_; g++) {
@@ -141,6 +141,37 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
+template <typename Dtype>
+int DataLayer<Dtype>::NumRecords() {
+  int count = 0;
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    {
+    leveldb::ReadOptions read_options;
+    read_options.fill_cache = false;
+    shared_ptr<leveldb::Iterator> iter(db_->NewIterator(read_options));
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ++count;
+    }
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    {
+    // The prefetch thread uses the transaction, so wait for it. The batch it
+    // prefetched stays for the next Forward, which restarts the thread.
+    this->JoinPrefetchThread();
+    MDB_stat mdb_stat_result;
+    CHECK_EQ(mdb_stat(mdb_txn_, mdb_dbi_, &mdb_stat_result), MDB_SUCCESS)
+        << "mdb_stat failed";
+    count = mdb_stat_result.ms_entries;
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return count;
+}
+
 // This function is used to create a thread that prefetches the data.
 template <typename Dtype>
 void DataLayer<Dtype>::InternalThreadEntry() {
@@ -152,6 +183,7 @@ void DataLayer<Dtype>::InternalThreadEntry() {
     top_label = this->prefetch_label_.mutable_cpu_data();
   }
   const int batch_size = this->layer_param_.data_param().batch_size();
+  this->prefetch_keys_.clear();
 
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
@@ -160,12 +192,15 @@ void DataLayer<Dtype>::InternalThreadEntry() {
       CHECK(iter_);
       CHECK(iter_->Valid());
       datum.ParseFromString(iter_->value().ToString());
+      this->prefetch_keys_.push_back(iter_->key().ToString());
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
       datum.ParseFromArray(mdb_value_.mv_data,
           mdb_value_.mv_size);
+      this->prefetch_keys_.push_back(string(
+          static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size));
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -16,6 +17,7 @@ void DotLossLayer<Dtype>::Reshape(
   CHECK_EQ(bottom[0]->width(), bottom[1]->width());
   nrma_.Reshape(bottom[0]->num(), 1, 1, 1);
   nrmb_.Reshape(bottom[0]->num(), 1, 1, 1);
+  cos_.Reshape(bottom[0]->num(), 1, 1, 1);
   if(bottom.size()>2)
     CHECK_EQ(bottom[2]->count(),bottom[2]->num());
   if(bottom.size()>3)
@@ -23,20 +25,51 @@ void DotLossLayer<Dtype>::Reshape(
 }
 
 
+// Computes a.a, b.b and a.b in a single pass over the two rows. Every product
+// keeps four independent partial sums, which breaks the dependency between
+// consecutive additions so the compiler can vectorize the loop.
+template <typename Dtype>
+static void fused_dots(const int n, const Dtype* a, const Dtype* b,
+    Dtype* aa, Dtype* bb, Dtype* ab) {
+  Dtype saa[4] = {0, 0, 0, 0}, sbb[4] = {0, 0, 0, 0}, sab[4] = {0, 0, 0, 0};
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (int k = 0; k < 4; ++k) {
+      saa[k] += a[i + k] * a[i + k];
+      sbb[k] += b[i + k] * b[i + k];
+      sab[k] += a[i + k] * b[i + k];
+    }
+  }
+  for (; i < n; ++i) {
+    saa[0] += a[i] * a[i];
+    sbb[0] += b[i] * b[i];
+    sab[0] += a[i] * b[i];
+  }
+  *aa = (saa[0] + saa[1]) + (saa[2] + saa[3]);
+  *bb = (sbb[0] + sbb[1]) + (sbb[2] + sbb[3]);
+  *ab = (sab[0] + sab[1]) + (sab[2] + sab[3]);
+}
+
 template <typename Dtype>
 void DotLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   Dtype* nrma=nrma_.mutable_cpu_data();
   Dtype* nrmb=nrmb_.mutable_cpu_data();
+  Dtype* cos=cos_.mutable_cpu_data();
   const Dtype* dptra=bottom[0]->cpu_data();
   const Dtype* dptrb=bottom[1]->cpu_data();
+  const int num=bottom[0]->num();
+  const int dim=bottom[0]->count()/num;
   Dtype loss =Dtype(0);
-  for(int i=0, dim = bottom[0]->count()/bottom[0]->num();i<bottom[0]->num();i++){
-    caffe_nrm2(dim, dptra+i*dim,nrma+i); 
-    caffe_nrm2(dim, dptrb+i*dim, nrmb+i); 
-    loss+=caffe_cpu_dot(dim, dptra+i*dim, dptrb+i*dim)/(nrma[i]*nrmb[i]);
+  for(int i=0;i<num;i++){
+    Dtype aa, bb, ab;
+    fused_dots(dim, dptra+i*dim, dptrb+i*dim, &aa, &bb, &ab);
+    nrma[i]=sqrt(aa);
+    nrmb[i]=sqrt(bb);
+    cos[i]=ab/(nrma[i]*nrmb[i]);
+    loss+=Dtype(1)-cos[i];
   }
-  (*top)[0]->mutable_cpu_data()[0] = loss/bottom[0]->num();
+  (*top)[0]->mutable_cpu_data()[0] = loss/num;
 }
 
 template <typename Dtype>
@@ -47,30 +80,38 @@ void DotLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     loss2=(*bottom)[2]->cpu_data();
     loss3=(*bottom)[3]->cpu_data();
   }
+  const Dtype* cos=cos_.cpu_data();
 
   for (int i = 0; i < 2; ++i) {
     if (propagate_down[i]) {
       const Dtype sign = (i == 0) ? 1 : -1;
-      const Dtype *nrm=(i==0)?nrmb_.cpu_data():nrma_.cpu_data();
-      const Dtype *dptr=(*bottom)[1-i]->cpu_data();
+      const Dtype *nrm=(i==0)?nrma_.cpu_data():nrmb_.cpu_data();
+      const Dtype *nrm_other=(i==0)?nrmb_.cpu_data():nrma_.cpu_data();
+      const Dtype *dptr=(*bottom)[i]->cpu_data();
+      const Dtype *dptr_other=(*bottom)[1-i]->cpu_data();
       Dtype *gptr=(*bottom)[i]->mutable_cpu_diff();
       int num=(*bottom)[i]->num();
       int dim=(*bottom)[i]->count()/num;
+      const Dtype scale=top[0]->cpu_diff()[0]/num;
       for(int j=0;j<num;j++){
-        Dtype alpha =Dtype(0);
-        if(loss2==NULL||sign*(loss2[j]-loss3[j])>0)
-          alpha=-1 * top[0]->cpu_diff()[0]/nrm[j]/num;
-        caffe_cpu_axpby(
-            dim, 
-            alpha,                       
-            dptr+j*dim,     
-            Dtype(0),                  
+        if(loss2!=NULL&&sign*(loss2[j]-loss3[j])<=0){
+          caffe_set(dim, Dtype(0), gptr+j*dim);
+          continue;
+        }
+        // scale * (cos / |x|^2 * x - y / (|x| |y|))
+        caffe_cpu_axpby(dim, -scale/(nrm[j]*nrm_other[j]), dptr_other+j*dim,
+            Dtype(0), gptr+j*dim);
+        caffe_axpy(dim, scale*cos[j]/(nrm[j]*nrm[j]), dptr+j*dim,
             gptr+j*dim);
       }
     }
   }
 }
 
+#ifdef CPU_ONLY
+STUB_GPU(DotLossLayer);
+#endif
+
 INSTANTIATE_CLASS(DotLossLayer);
 
 }  // namespace caffe
@@ -0,0 +1,95 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per pair: both norms and the cosine in a single pass.
+template <typename Dtype>
+__global__ void DotLossForward(const int num, const int dim,
+    const Dtype* a, const Dtype* b, Dtype* nrma, Dtype* nrmb, Dtype* cos) {
+  CUDA_KERNEL_LOOP(n, num) {
+    Dtype aa = 0, bb = 0, ab = 0;
+    for (int d = 0; d < dim; ++d) {
+      const Dtype x = a[n * dim + d];
+      const Dtype y = b[n * dim + d];
+      aa += x * x;
+      bb += y * y;
+      ab += x * y;
+    }
+    nrma[n] = sqrt(aa);
+    nrmb[n] = sqrt(bb);
+    cos[n] = ab / (nrma[n] * nrmb[n]);
+  }
+}
+
+template <typename Dtype>
+void DotLossLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  DotLossForward<Dtype><<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS>>>(
+      num, dim, bottom[0]->gpu_data(), bottom[1]->gpu_data(),
+      nrma_.mutable_gpu_data(), nrmb_.mutable_gpu_data(),
+      cos_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  const Dtype* cos = cos_.cpu_data();
+  Dtype loss(0.0);
+  for (int i = 0; i < num; ++i) {
+    loss += Dtype(1) - cos[i];
+  }
+  (*top)[0]->mutable_cpu_data()[0] = loss / num;
+}
+
+// Gradient of the cosine distance w.r.t. x, the other side being y; pairs
+// whose x branch has the smaller loss (loss2 vs. loss3, if given) get zero.
+template <typename Dtype>
+__global__ void DotLossBackward(const int count, const int dim,
+    const Dtype scale, const Dtype sign, const Dtype* x, const Dtype* y,
+    const Dtype* nrmx, const Dtype* nrmy, const Dtype* cos,
+    const Dtype* loss2, const Dtype* loss3, Dtype* x_diff) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const int n = i / dim;
+    if (loss2 == NULL || sign * (loss2[n] - loss3[n]) > 0) {
+      x_diff[i] = scale * (cos[n] * x[i] / (nrmx[n] * nrmx[n])
+          - y[i] / (nrmx[n] * nrmy[n]));
+    } else {
+      x_diff[i] = 0;
+    }
+  }
+}
+
+template <typename Dtype>
+void DotLossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype* loss2 = NULL, *loss3 = NULL;
+  if (bottom->size() > 3) {
+    loss2 = (*bottom)[2]->gpu_data();
+    loss3 = (*bottom)[3]->gpu_data();
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (propagate_down[i]) {
+      const int count = (*bottom)[i]->count();
+      const int num = (*bottom)[i]->num();
+      const Dtype sign = (i == 0) ? 1 : -1;
+      const Dtype scale = top[0]->cpu_diff()[0] / num;
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      DotLossBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(
+          count, count / num, scale, sign,
+          (*bottom)[i]->gpu_data(), (*bottom)[1 - i]->gpu_data(),
+          (i == 0 ? nrma_ : nrmb_).gpu_data(),
+          (i == 0 ? nrmb_ : nrma_).gpu_data(),
+          cos_.gpu_data(), loss2, loss3, (*bottom)[i]->mutable_gpu_diff());
+      CUDA_POST_KERNEL_CHECK;
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DotLossLayer);
+
+}  // namespace caffe
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void InfoNCELossLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  LossLayer<Dtype>::LayerSetUp(bottom, top);
+  temperature_ = this->layer_param_.infonce_param().temperature();
+  CHECK_GT(temperature_, 0) << "temperature must be positive";
+  normalize_ = this->layer_param_.infonce_param().normalize();
+}
+
+template <typename Dtype>
+void InfoNCELossLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  LossLayer<Dtype>::Reshape(bottom, top);
+  CHECK_EQ(bottom[0]->count(), bottom[1]->count())
+      << "The two modalities must have the same embedding dimension.";
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  if (normalize_) {
+    a_.Reshape(num, dim, 1, 1);
+    b_.Reshape(num, dim, 1, 1);
+    nrma_.Reshape(num, 1, 1, 1);
+    nrmb_.Reshape(num, 1, 1, 1);
+  }
+  sim_.Reshape(num, num, 1, 1);
+}
+
+template <typename Dtype>
+void InfoNCELossLayer<Dtype>::Normalize(const Blob<Dtype>& in,
+    Blob<Dtype>* norm, Blob<Dtype>* out) {
+  const int num = in.num();
+  const int dim = in.count() / num;
+  const Dtype* in_data = in.cpu_data();
+  Dtype* nrm = norm->mutable_cpu_data();
+  Dtype* out_data = out->mutable_cpu_data();
+  for (int i = 0; i < num; ++i) {
+    nrm[i] = std::max(sqrt(caffe_cpu_dot(dim, in_data + i * dim,
+        in_data + i * dim)), Dtype(1e-12));
+    caffe_cpu_scale(dim, Dtype(1) / nrm[i], in_data + i * dim,
+        out_data + i * dim);
+  }
+}
+
+template <typename Dtype>
+void InfoNCELossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  const Dtype* a = bottom[0]->cpu_data();
+  const Dtype* b = bottom[1]->cpu_data();
+  if (normalize_) {
+    Normalize(*bottom[0], &nrma_, &a_);
+    Normalize(*bottom[1], &nrmb_, &b_);
+    a = a_.cpu_data();
+    b = b_.cpu_data();
+  }
+  // All the image-text pairs of the batch at once: S = a * b' / T.
+  Dtype* sim = sim_.mutable_cpu_data();
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim,
+      Dtype(1) / temperature_, a, b, Dtype(0), sim);
+  // The diff of sim_ keeps the row softmax plus the column softmax, minus
+  // 2 on the diagonal, i.e., (2N times) the gradient of the loss w.r.t. S.
+  Dtype* grad = sim_.mutable_cpu_diff();
+  Dtype loss = 0;
+  // a -> b: softmax over each row
+  for (int i = 0; i < num; ++i) {
+    const Dtype* row = sim + i * num;
+    const Dtype maxval = *std::max_element(row, row + num);
+    Dtype sum = 0;
+    for (int j = 0; j < num; ++j) {
+      grad[i * num + j] = exp(row[j] - maxval);
+      sum += grad[i * num + j];
+    }
+    caffe_scal(num, Dtype(1) / sum, grad + i * num);
+    loss += maxval + log(sum) - row[i];
+  }
+  // b -> a: softmax over each column
+  for (int j = 0; j < num; ++j) {
+    Dtype maxval = sim[j];
+    for (int i = 1; i < num; ++i) {
+      maxval = std::max(maxval, sim[i * num + j]);
+    }
+    Dtype sum = 0;
+    for (int i = 0; i < num; ++i) {
+      sum += exp(sim[i * num + j] - maxval);
+    }
+    const Dtype lse = maxval + log(sum);
+    for (int i = 0; i < num; ++i) {
+      grad[i * num + j] += exp(sim[i * num + j] - lse);
+    }
+    grad[j * num + j] -= 2;
+    loss += lse - sim[j * num + j];
+  }
+  (*top)[0]->mutable_cpu_data()[0] = loss / (2 * num);
+}
+
+// Backpropagates g, the gradient w.r.t. the normalized rows x / |x|, to x.
+template <typename Dtype>
+static void normalize_backward(const int num, const int dim,
+    const Dtype* norm_data, const Dtype* nrm, Dtype* g) {
+  for (int i = 0; i < num; ++i) {
+    const Dtype* x = norm_data + i * dim;
+    const Dtype xg = caffe_cpu_dot(dim, x, g + i * dim);
+    caffe_axpy(dim, -xg, x, g + i * dim);
+    caffe_scal(dim, Dtype(1) / nrm[i], g + i * dim);
+  }
+}
+
+template <typename Dtype>
+void InfoNCELossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const int num = (*bottom)[0]->num();
+  const int dim = (*bottom)[0]->count() / num;
+  const Dtype* a = normalize_ ? a_.cpu_data() : (*bottom)[0]->cpu_data();
+  const Dtype* b = normalize_ ? b_.cpu_data() : (*bottom)[1]->cpu_data();
+  const Dtype* grad = sim_.cpu_diff();
+  const Dtype scale = top[0]->cpu_diff()[0] / (2 * num * temperature_);
+  if (propagate_down[0]) {
+    Dtype* a_diff = (*bottom)[0]->mutable_cpu_diff();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, num,
+        scale, grad, b, Dtype(0), a_diff);
+    if (normalize_) {
+      normalize_backward(num, dim, a, nrma_.cpu_data(), a_diff);
+    }
+  }
+  if (propagate_down[1]) {
+    Dtype* b_diff = (*bottom)[1]->mutable_cpu_diff();
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num, dim, num,
+        scale, grad, a, Dtype(0), b_diff);
+    if (normalize_) {
+      normalize_backward(num, dim, b, nrmb_.cpu_data(), b_diff);
+    }
+  }
+}
+
+INSTANTIATE_CLASS(InfoNCELossLayer);
+
+}  // namespace caffe
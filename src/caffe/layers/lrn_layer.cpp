@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -6,6 +8,26 @@
 
 namespace caffe {
 
+// The number of pixels that ACROSS_CHANNELS normalization carries through all
+// the channels at once on CPU. The size_ channels of a tile that make up the
+// sliding window stay in L1, so that every value is loaded from memory once.
+static const int kLRNTile = 256;
+
+// y = x^-beta, with a fast path for the common beta = 0.75, where
+// 1 / sqrt(x * sqrt(x)) vectorizes and pow() does not.
+template <typename Dtype>
+static void lrn_pow(const int n, const Dtype* x, const Dtype beta, Dtype* y) {
+  if (beta == Dtype(0.75)) {
+    for (int i = 0; i < n; ++i) {
+      y[i] = 1 / sqrt(x[i] * sqrt(x[i]));
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      y[i] = pow(x[i], -beta);
+    }
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -76,6 +98,7 @@ void LRNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     (*top)[0]->Reshape(num_, channels_, height_, width_);
     scale_.Reshape(num_, channels_, height_, width_);
+    ratio_buffer_.Reshape(1, 1, size_, kLRNTile);
     break;
   case LRNParameter_NormRegion_WITHIN_CHANNEL:
     split_layer_->Reshape(bottom, &split_top_vec_);
@@ -108,45 +131,50 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = 1.;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int spatial = height_ * width_;
+  // the sum of squares over the window of channels, and scale^-beta
+  Dtype accum[kLRNTile];
+  Dtype power[kLRNTile];
+  // go through the images, one spatial tile at a time
   for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
-    }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int p = 0; p < spatial; p += kLRNTile) {
+      const int len = std::min(kLRNTile, spatial - p);
+      const Dtype* in = bottom_data + bottom[0]->offset(n) + p;
+      Dtype* scale = scale_data + scale_.offset(n) + p;
+      Dtype* out = top_data + (*top)[0]->offset(n) + p;
+      // the window of channel 0, but for its head
+      caffe_set(len, Dtype(0), accum);
+      for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+        for (int i = 0; i < len; ++i) {
+          accum[i] += in[c * spatial + i] * in[c * spatial + i];
+        }
+      }
+      for (int c = 0; c < channels_; ++c) {
+        // add head
+        const int head = c + pre_pad_;
+        if (head < channels_) {
+          for (int i = 0; i < len; ++i) {
+            accum[i] += in[head * spatial + i] * in[head * spatial + i];
+          }
+        }
+        for (int i = 0; i < len; ++i) {
+          scale[c * spatial + i] = 1 + alpha_over_size * accum[i];
+        }
+        lrn_pow(len, scale + c * spatial, beta_, power);
+        for (int i = 0; i < len; ++i) {
+          out[c * spatial + i] = in[c * spatial + i] * power[i];
+        }
+        // subtract tail
+        const int tail = c - pre_pad_;
+        if (tail >= 0) {
+          for (int i = 0; i < len; ++i) {
+            accum[i] -= in[tail * spatial + i] * in[tail * spatial + i];
+          }
+        }
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -183,48 +211,53 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
+  // The ratios diff_i * y_i / s_i of the window, in a ring of size_ rows:
+  // those of channel c live in row c % size_.
+  Dtype* ratio = ratio_buffer_.mutable_cpu_data();
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  const int spatial = height_ * width_;
+  // the accumulated ratios over the window of channels, and scale^-beta
+  Dtype accum[kLRNTile];
+  Dtype power[kLRNTile];
   for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+    for (int p = 0; p < spatial; p += kLRNTile) {
+      const int len = std::min(kLRNTile, spatial - p);
+      const int offset = scale_.offset(n) + p;
+      const Dtype* tdiff = top_diff + offset;
+      const Dtype* tdata = top_data + offset;
+      const Dtype* scale = scale_data + offset;
+      const Dtype* in = bottom_data + offset;
+      Dtype* bdiff = bottom_diff + offset;
+      caffe_set(len, Dtype(0), accum);
+      for (int c = 0; c < channels_ + pre_pad_; ++c) {
+        // add head: the ratio of channel c, whose window ends at c - pre_pad_
+        if (c < channels_) {
+          Dtype* r = ratio + (c % size_) * kLRNTile;
+          for (int i = 0; i < len; ++i) {
+            r[i] = tdiff[c * spatial + i] * tdata[c * spatial + i] /
+                scale[c * spatial + i];
+            accum[i] += r[i];
+          }
+        }
+        // compute bottom diff of channel c - pre_pad_
+        const int k = c - pre_pad_;
+        if (k < 0) {
+          continue;
+        }
+        lrn_pow(len, scale + k * spatial, beta_, power);
+        for (int i = 0; i < len; ++i) {
+          bdiff[k * spatial + i] = tdiff[k * spatial + i] * power[i] -
+              cache_ratio_value * in[k * spatial + i] * accum[i];
+        }
+        // subtract tail
+        const int tail = k - pre_pad_;
+        if (tail >= 0) {
+          const Dtype* r = ratio + (tail % size_) * kLRNTile;
+          for (int i = 0; i < len; ++i) {
+            accum[i] -= r[i];
+          }
+        }
+      }
     }
   }
 }
@@ -138,6 +138,13 @@ void NuswideDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+int NuswideDataLayer<Dtype>::NumRecords() {
+  // The first records are skipped on every pass.
+  return DataLayer<Dtype>::NumRecords() -
+      this->layer_param_.data_param().skip();
+}
+
 // This function is used to create a thread that prefetches the data.
 template <typename Dtype>
 void NuswideDataLayer<Dtype>::InternalThreadEntry() {
@@ -150,6 +157,7 @@ void NuswideDataLayer<Dtype>::InternalThreadEntry() {
     top_label = this->prefetch_label_.mutable_cpu_data();
   }
   const int batch_size = this->layer_param_.data_param().batch_size();
+  this->prefetch_keys_.clear();
 
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
@@ -158,12 +166,16 @@ void NuswideDataLayer<Dtype>::InternalThreadEntry() {
         CHECK(this->iter_);
         CHECK(this->iter_->Valid());
         datum.ParseFromString(this->iter_->value().ToString());
+        this->prefetch_keys_.push_back(this->iter_->key().ToString());
         break;
       case DataParameter_DB_LMDB:
         CHECK_EQ(mdb_cursor_get(this->mdb_cursor_, &this->mdb_key_,
               &this->mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
         datum.ParseFromArray(this->mdb_value_.mv_data,
             this->mdb_value_.mv_size);
+        this->prefetch_keys_.push_back(string(
+            static_cast<const char*>(this->mdb_key_.mv_data),
+            this->mdb_key_.mv_size));
         break;
       default:
         LOG(FATAL) << "Unknown database backend";
@@ -13,6 +13,48 @@ namespace caffe {
 using std::min;
 using std::max;
 
+// Max pools one row of outputs from rm, the column-wise max of the kernel_h
+// rows of their windows, and ra, the row offset of each of those maxima.
+// The ties go to the first maximum in row-major order, as in the generic
+// loop. Inlined with constant kernel_w and stride_w, the loop computes
+// several adjacent outputs at a time.
+template <typename Dtype>
+static inline void max_pool_row(const int kernel_w, const int stride_w,
+    const int pooled_width, const Dtype* rm, const Dtype* ra, Dtype* out,
+    uint8_t* offset) {
+  for (int pw = 0; pw < pooled_width; ++pw) {
+    const Dtype* m = rm + pw * stride_w;
+    const Dtype* a = ra + pw * stride_w;
+    Dtype best = m[0];
+    int best_w = 0;
+    for (int w = 1; w < kernel_w; ++w) {
+      if (m[w] > best || (m[w] == best && a[w] < a[best_w])) {
+        best = m[w];
+        best_w = w;
+      }
+    }
+    out[pw] = best;
+    offset[pw] = static_cast<uint8_t>(a[best_w]) * kernel_w + best_w;
+  }
+}
+
+// Average pools one row of outputs from rs, the column-wise sum of the rows
+// of their windows, which are rows high.
+template <typename Dtype>
+static inline void ave_pool_row(const int kernel_w, const int stride_w,
+    const int pooled_width, const int width, const int rows, const Dtype* rs,
+    Dtype* out) {
+  for (int pw = 0; pw < pooled_width; ++pw) {
+    const Dtype* r = rs + pw * stride_w;
+    Dtype sum = 0;
+    for (int w = 0; w < kernel_w; ++w) {
+      sum += r[w];
+    }
+    const int cols = min(pw * stride_w + kernel_w, width) - pw * stride_w;
+    out[pw] = sum / (rows * cols);
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -51,6 +93,13 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     stride_h_ = pool_param.stride_h();
     stride_w_ = pool_param.stride_w();
   }
+  if (pool_param.compact_mask()) {
+    CHECK_LE(kernel_h_ * kernel_w_, 256)
+        << "compact_mask stores window offsets in 8 bits.";
+    // Otherwise the last window may lie past the image and have no argmax.
+    CHECK_LE(stride_h_, kernel_h_) << "compact_mask needs stride <= kernel.";
+    CHECK_LE(stride_w_, kernel_w_) << "compact_mask needs stride <= kernel.";
+  }
   if (pad_h_ != 0 || pad_w_ != 0) {
     CHECK(this->layer_param_.pooling_param().pool()
         == PoolingParameter_PoolMethod_AVE
@@ -95,6 +144,22 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
   }
+  // On CPU, max pooling keeps the argmax as window offsets: for the whole top
+  // with compact_mask, or else for one channel before they are expanded to
+  // indices.
+  if (this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX) {
+    const size_t offset_count = use_compact_mask(*top) ?
+        (*top)[0]->count() : pooled_height_ * pooled_width_;
+    if (!max_offset_ || max_offset_->size() < offset_count) {
+      max_offset_.reset(new SyncedMemory(offset_count * sizeof(uint8_t)));
+    }
+  }
+  // The rows of column-wise maxima (and their row offsets, in the diff) or
+  // sums of the separable CPU path, padded to whole windows.
+  if (use_separable()) {
+    row_buffer_.Reshape(1, 1, 1, width_ + kernel_w_);
+  }
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling_param().pool() ==
       PoolingParameter_PoolMethod_STOCHASTIC) {
@@ -103,6 +168,70 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void PoolingLayer<Dtype>::MaxPoolSeparable_cpu(const Dtype* bottom_data,
+    Dtype* top_data, uint8_t* offset) {
+  Dtype* rm = row_buffer_.mutable_cpu_data();
+  Dtype* ra = row_buffer_.mutable_cpu_diff();
+  // The windows of the last column may stick out of the image.
+  caffe_set(kernel_w_, Dtype(-FLT_MAX), rm + width_);
+  caffe_set(kernel_w_, Dtype(0), ra + width_);
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int hstart = ph * stride_h_;
+    const int hend = min(hstart + kernel_h_, height_);
+    // max over the rows of the windows
+    caffe_copy(width_, bottom_data + hstart * width_, rm);
+    caffe_set(width_, Dtype(0), ra);
+    for (int h = hstart + 1; h < hend; ++h) {
+      const Dtype* row = bottom_data + h * width_;
+      const Dtype dh = h - hstart;
+      for (int w = 0; w < width_; ++w) {
+        if (row[w] > rm[w]) {
+          rm[w] = row[w];
+          ra[w] = dh;
+        }
+      }
+    }
+    // max over the columns of the windows
+    Dtype* out = top_data + ph * pooled_width_;
+    uint8_t* off = offset + ph * pooled_width_;
+    if (kernel_w_ == 3 && stride_w_ == 2) {
+      max_pool_row(3, 2, pooled_width_, rm, ra, out, off);
+    } else if (kernel_w_ == 2 && stride_w_ == 2) {
+      max_pool_row(2, 2, pooled_width_, rm, ra, out, off);
+    } else {
+      max_pool_row(kernel_w_, stride_w_, pooled_width_, rm, ra, out, off);
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::AvePoolSeparable_cpu(const Dtype* bottom_data,
+    Dtype* top_data) {
+  Dtype* rs = row_buffer_.mutable_cpu_data();
+  caffe_set(kernel_w_, Dtype(0), rs + width_);
+  for (int ph = 0; ph < pooled_height_; ++ph) {
+    const int hstart = ph * stride_h_;
+    const int hend = min(hstart + kernel_h_, height_);
+    // sum over the rows of the windows
+    caffe_copy(width_, bottom_data + hstart * width_, rs);
+    for (int h = hstart + 1; h < hend; ++h) {
+      caffe_axpy(width_, Dtype(1), bottom_data + h * width_, rs);
+    }
+    // mean over the windows
+    Dtype* out = top_data + ph * pooled_width_;
+    const int rows = hend - hstart;
+    if (kernel_w_ == 3 && stride_w_ == 2) {
+      ave_pool_row(3, 2, pooled_width_, width_, rows, rs, out);
+    } else if (kernel_w_ == 2 && stride_w_ == 2) {
+      ave_pool_row(2, 2, pooled_width_, width_, rows, rs, out);
+    } else {
+      ave_pool_row(kernel_w_, stride_w_, pooled_width_, width_, rows, rs,
+          out);
+    }
+  }
+}
+
 // TODO(Yangqing): Is there a faster way to do pooling in the channel-first
 // case?
 template <typename Dtype>
@@ -113,17 +242,24 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int top_count = (*top)[0]->count();
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top->size() > 1;
+  // Otherwise, the mask is either window offsets or indices.
+  const bool use_offset = use_compact_mask(*top);
+  // Windows without padding are pooled a row of windows at a time.
+  const bool separable = use_separable();
+  const int pooled_count = pooled_height_ * pooled_width_;
   int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
+  uint8_t* offset = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
     // Initialize
+    offset = static_cast<uint8_t*>(max_offset_->mutable_cpu_data());
     if (use_top_mask) {
       top_mask = (*top)[1]->mutable_cpu_data();
       caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
+    } else if (!use_offset) {
       mask = max_idx_.mutable_cpu_data();
       caffe_set(top_count, -1, mask);
     }
@@ -131,24 +267,47 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     // The main loop
     for (int n = 0; n < bottom[0]->num(); ++n) {
       for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
+        if (separable) {
+          MaxPoolSeparable_cpu(bottom_data, top_data, offset);
+          if (!use_offset) {
+            // expand the offsets to indices
+            for (int ph = 0; ph < pooled_height_; ++ph) {
+              for (int pw = 0; pw < pooled_width_; ++pw) {
+                const int pool_index = ph * pooled_width_ + pw;
+                const int index =
+                    (ph * stride_h_ + offset[pool_index] / kernel_w_) * width_
+                    + pw * stride_w_ + offset[pool_index] % kernel_w_;
+                if (use_top_mask) {
+                  top_mask[pool_index] = static_cast<Dtype>(index);
+                } else {
+                  mask[pool_index] = index;
+                }
+              }
+            }
+          }
+        } else {
+          for (int ph = 0; ph < pooled_height_; ++ph) {
+            for (int pw = 0; pw < pooled_width_; ++pw) {
+              const int hwindow = ph * stride_h_ - pad_h_;
+              const int wwindow = pw * stride_w_ - pad_w_;
+              int hend = min(hwindow + kernel_h_, height_);
+              int wend = min(wwindow + kernel_w_, width_);
+              int hstart = max(hwindow, 0);
+              int wstart = max(wwindow, 0);
+              const int pool_index = ph * pooled_width_ + pw;
+              for (int h = hstart; h < hend; ++h) {
+                for (int w = wstart; w < wend; ++w) {
+                  const int index = h * width_ + w;
+                  if (bottom_data[index] > top_data[pool_index]) {
+                    top_data[pool_index] = bottom_data[index];
+                    if (use_top_mask) {
+                      top_mask[pool_index] = static_cast<Dtype>(index);
+                    } else if (use_offset) {
+                      offset[pool_index] =
+                          (h - hwindow) * kernel_w_ + w - wwindow;
+                    } else {
+                      mask[pool_index] = index;
+                    }
                   }
                 }
               }
@@ -160,6 +319,8 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         top_data += (*top)[0]->offset(0, 1);
         if (use_top_mask) {
           top_mask += (*top)[0]->offset(0, 1);
+        } else if (use_offset) {
+          offset += pooled_count;
         } else {
           mask += (*top)[0]->offset(0, 1);
         }
@@ -173,24 +334,28 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     // The main loop
     for (int n = 0; n < bottom[0]->num(); ++n) {
       for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
+        if (separable) {
+          AvePoolSeparable_cpu(bottom_data, top_data);
+        } else {
+          for (int ph = 0; ph < pooled_height_; ++ph) {
+            for (int pw = 0; pw < pooled_width_; ++pw) {
+              int hstart = ph * stride_h_ - pad_h_;
+              int wstart = pw * stride_w_ - pad_w_;
+              int hend = min(hstart + kernel_h_, height_ + pad_h_);
+              int wend = min(wstart + kernel_w_, width_ + pad_w_);
+              int pool_size = (hend - hstart) * (wend - wstart);
+              hstart = max(hstart, 0);
+              wstart = max(wstart, 0);
+              hend = min(hend, height_);
+              wend = min(wend, width_);
+              for (int h = hstart; h < hend; ++h) {
+                for (int w = wstart; w < wend; ++w) {
+                  top_data[ph * pooled_width_ + pw] +=
+                      bottom_data[h * width_ + w];
+                }
               }
+              top_data[ph * pooled_width_ + pw] /= pool_size;
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
         }
         // compute offset
@@ -220,13 +385,17 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   caffe_set((*bottom)[0]->count(), Dtype(0), bottom_diff);
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
+  const bool use_offset = use_compact_mask(top);
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  const uint8_t* offset = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
     // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
+    } else if (use_offset) {
+      offset = static_cast<const uint8_t*>(max_offset_->cpu_data());
     } else {
       mask = max_idx_.cpu_data();
     }
@@ -235,15 +404,26 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         for (int ph = 0; ph < pooled_height_; ++ph) {
           for (int pw = 0; pw < pooled_width_; ++pw) {
             const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
+            int bottom_index;
+            if (use_offset) {
+              bottom_index =
+                  (ph * stride_h_ - pad_h_ + offset[index] / kernel_w_) *
+                  width_ + pw * stride_w_ - pad_w_ + offset[index] % kernel_w_;
+            } else {
+              bottom_index = use_top_mask ? top_mask[index] : mask[index];
+            }
+            // Windows past the image when stride > kernel have no argmax.
+            if (bottom_index >= 0) {
+              bottom_diff[bottom_index] += top_diff[index];
+            }
           }
         }
         bottom_diff += (*bottom)[0]->offset(0, 1);
         top_diff += top[0]->offset(0, 1);
         if (use_top_mask) {
           top_mask += top[0]->offset(0, 1);
+        } else if (use_offset) {
+          offset += pooled_height_ * pooled_width_;
         } else {
           mask += top[0]->offset(0, 1);
         }
@@ -14,6 +14,8 @@ template <typename Dtype>
 void PrecisionRecallLayer<Dtype>::LayerSetUp(
   const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   top_k_ = this->layer_param_.pr_param().top_k();
+  CHECK_GT(top_k_, 0);
+  heap_.resize(top_k_);
 }
 
 template <typename Dtype>
@@ -33,43 +35,40 @@ template <typename Dtype>
 void PrecisionRecallLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* bottom_label = bottom[1]->cpu_data();
   int num = bottom[0]->num();
   int dim = bottom[0]->count() / bottom[0]->num();
-  int label_dim=bottom[1]->count()/num;
-  vector<Dtype> maxval(top_k_+1);
-  Dtype recall=0.f, precision=0.f;
-  Dtype ncorrect = 0, ntotal=0;
+  labels_.FromBlob(*bottom[1]);
+  CHECK_GT(labels_.nnz(), 0);
+  typedef std::pair<Dtype, int> Score;
+  // min-heap on the score, so front() is the weakest of the current top k
+  Score* heap = &heap_[0];
+  std::greater<Score> comp;
+  Dtype ncorrect = 0;
   for (int i = 0; i < num; ++i) {
-    // Top-k accuracy
-    std::vector<std::pair<Dtype, int> > bottom_data_vector;
-    for (int j = 0; j < dim; ++j) {
-      bottom_data_vector.push_back(
-          std::make_pair(bottom_data[i * dim + j], j));
+    const Dtype* score = bottom_data + i * dim;
+    for (int j = 0; j < top_k_; ++j) {
+      heap[j] = std::make_pair(score[j], j);
     }
-    std::partial_sort(
-        bottom_data_vector.begin(), bottom_data_vector.begin() + top_k_,
-        bottom_data_vector.end(), std::greater<std::pair<Dtype, int> >());
-    // sort label id in ascending order
-    // std::sort(bottom_data_vector.begin(), bottom_data_vector.begin()+top_k_);
-    // check if true label is in top k predictions
-    for(int j=0;bottom_label[label_dim*i+j]!=-1&&j<label_dim;j++){
-      int label=static_cast<int>(bottom_label[label_dim*i+j]);
-      for (int k = 0; k < top_k_; k++) {
-        if (bottom_data_vector[k].second == label){
-          ++ncorrect;
-          break;
-        }
+    std::make_heap(heap, heap + top_k_, comp);
+    for (int j = top_k_; j < dim; ++j) {
+      const Score candidate(score[j], j);
+      if (comp(candidate, heap[0])) {
+        std::pop_heap(heap, heap + top_k_, comp);
+        heap[top_k_ - 1] = candidate;
+        std::push_heap(heap, heap + top_k_, comp);
       }
-      ++ntotal;
     }
-    CHECK_GT(ntotal,0);
+    // check if true label is in top k predictions
+    for (int k = 0; k < top_k_; ++k) {
+      if (labels_.Contains(i, heap[k].second))
+        ++ncorrect;
+    }
   }
 
   // precision
   (*top)[0]->mutable_cpu_data()[0] = ncorrect / top_k_ / num;
   // recall
-  (*top)[0]->mutable_cpu_data()[1] = ncorrect / ntotal;
+  (*top)[0]->mutable_cpu_data()[1] = ncorrect / labels_.nnz();
   // Accuracy layer should not be used as a loss function.
 }
 
@@ -7,6 +7,7 @@
 #include <fstream>  // NOLINT(readability/streams)
 
 #include "caffe/layer.hpp"
+#include "caffe/util/feature_io.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
@@ -20,65 +21,144 @@ void RankHingeLossLayer<Dtype>::LayerSetUp(
   margin_ = this->layer_param_.rank_hinge_param().margin();
   if(this->layer_param_.rank_hinge_param().has_label_dict()){
     string label_dict_fname=this->layer_param_.rank_hinge_param().label_dict();
-    std::ifstream fin(label_dict_fname.c_str(), std::ifstream::in);
-    std::vector<string> lines;
-    while(!fin.eof()){
-      string line;
-      std::getline(fin, line);
-      if(fin.eof())
-        break;
-      lines.push_back(line);
-    }
     int dim=bottom[0]->channels();
-    label_vec_.Reshape(lines.size(), dim, 1, 1);
-    for(int i=0;i<lines.size();i++){
-      std::vector<std::string> strs;
-      boost::split(strs, lines[i], boost::is_any_of(" "));
-      int labelid=boost::lexical_cast<int>(strs[0]);
-      CHECK_EQ(dim, strs.size()-1);
-      Dtype *vec=label_vec_.mutable_cpu_data()+dim*labelid;
-      for(int i=0;i<dim;i++)
-        vec[i]=boost::lexical_cast<Dtype>(strs[i+1]);
+    if(IsFeatureFile(label_dict_fname)){
+      // binary dictionary from convert_label_dict: row i is label id i
+      MappedFeatureFile dict(label_dict_fname);
+      CHECK_EQ(dim, dict.dim())<<"label vectors in "<<label_dict_fname
+        <<" must match the dimension of bottom[0]";
+      label_vec_.Reshape(dict.num(), dim, 1, 1);
+      const float* vec=dict.data();
+      Dtype* table=label_vec_.mutable_cpu_data();
+      for(int i=0;i<label_vec_.count();i++)
+        table[i]=static_cast<Dtype>(vec[i]);
+    }else{
+      std::ifstream fin(label_dict_fname.c_str(), std::ifstream::in);
+      CHECK(fin.is_open())<<"Cannot open label dict "<<label_dict_fname;
+      std::vector<string> lines;
+      while(!fin.eof()){
+        string line;
+        std::getline(fin, line);
+        if(fin.eof())
+          break;
+        lines.push_back(line);
+      }
+      label_vec_.Reshape(lines.size(), dim, 1, 1);
+      for(int i=0;i<lines.size();i++){
+        std::vector<std::string> strs;
+        boost::split(strs, lines[i], boost::is_any_of(" "));
+        int labelid=boost::lexical_cast<int>(strs[0]);
+        CHECK_EQ(dim, strs.size()-1);
+        Dtype *vec=label_vec_.mutable_cpu_data()+dim*labelid;
+        for(int i=0;i<dim;i++)
+          vec[i]=boost::lexical_cast<Dtype>(strs[i+1]);
+      }
+    }
+    // normalize the table once, so single-label rows need no work in Forward
+    for(int i=0;i<label_vec_.num();i++){
+      Dtype nrm;
+      caffe_nrm2(dim, label_vec_.cpu_data()+i*dim, &nrm);
+      if(nrm>Dtype(0))
+        caffe_scal(dim, Dtype(1)/nrm, label_vec_.mutable_cpu_data()+i*dim);
     }
   }
 }
 
 
+template <typename Dtype>
+void RankHingeLossLayer<Dtype>::Reshape(
+  const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  LossLayer<Dtype>::Reshape(bottom, top);
+  norm_label_.Reshape(bottom[0]->num(), bottom[0]->channels(), 1, 1);
+  if(this->layer_param_.rank_hinge_param().negative_mining()
+      !=RankHingeParameter_NegativeMining_RANDOM)
+    scores_.Reshape(bottom[0]->num(), bottom[0]->num(), 1, 1);
+}
+
+template <typename Dtype>
+bool RankHingeLossLayer<Dtype>::IsNegative(const vector<Blob<Dtype>*>& bottom,
+    int i, int k) {
+  // negatives share no label
+  return k!=i&&!labels_.Shares(i, k);
+}
+
+template <typename Dtype>
+int RankHingeLossLayer<Dtype>::MineNegative(const vector<Blob<Dtype>*>& bottom,
+    int i) {
+  const int num=scores_.num();
+  const Dtype* score=scores_.cpu_data()+i*num;
+  const Dtype positive=score[i];
+  int hardest=-1, semi_hard=-1;
+  for(int k=0;k<num;k++){
+    if(!IsNegative(bottom, i, k))
+      continue;
+    if(hardest<0||score[k]>score[hardest])
+      hardest=k;
+    // ranked below the positive, but still violating the margin
+    if(score[k]<positive&&score[k]+margin_>positive
+        &&(semi_hard<0||score[k]>score[semi_hard]))
+      semi_hard=k;
+  }
+  if(this->layer_param_.rank_hinge_param().negative_mining()
+      ==RankHingeParameter_NegativeMining_SEMI_HARD&&semi_hard>=0)
+    return semi_hard;
+  return hardest;
+}
+
 template <typename Dtype>
 void RankHingeLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* dptr = bottom[0]->cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  const Dtype* label;
-  Dtype* mutable_label ;
   int num = bottom[0]->num();
   int count = bottom[0]->count();
   int dim =bottom[0]->channels(); 
+  Dtype* label = norm_label_.mutable_cpu_data();
+  labels_.FromBlob(*bottom[1]);
   if(label_vec_.count()>0){
-    mutable_label=new Dtype[count];
-    label=mutable_label;
-    for(int i=0, labeldim=bottom[1]->channels();i<num;i++){
-      for(int j=0;j<labeldim;j++){
-        int labelid=static_cast<int>(bottom[1]->cpu_data()[i*labeldim+j]);
-        if(labelid==-1) break;
-        CHECK_LT(labelid, label_vec_.num());
-        caffe_cpu_axpby(dim, Dtype(1), label_vec_.cpu_data()+labelid*dim, 
-            j==0?Dtype(0):Dtype(1), mutable_label+dim*i);
+    // sum the label vectors of each example, i.e., the product of the sparse
+    // num x #labels indicator matrix given by bottom[1] and label_vec_
+    caffe_set(count, Dtype(0), label);
+    CHECK_LE(labels_.num_classes(), label_vec_.num());
+    for(int i=0;i<num;i++){
+      const int* labelids=labels_.labels(i);
+      for(int k=0;k<labels_.size(i);k++)
+        caffe_axpy(dim, Dtype(1), label_vec_.cpu_data()+labelids[k]*dim,
+            label+i*dim);
+      if(labels_.size(i)>1){
+        Dtype nrm;
+        caffe_nrm2(dim, label+i*dim, &nrm);
+        if(nrm>Dtype(0))
+          caffe_scal(dim, Dtype(1)/nrm, label+i*dim);
       }
     }
   }else{
-    label=bottom[2]->cpu_data();
-    mutable_label=bottom[2]->mutable_cpu_data();
+    caffe_copy(count, bottom[2]->cpu_data(), label);
+    for (int i=0;i<num;i++){
+      Dtype nrm;
+      caffe_nrm2(dim, label+i*dim, &nrm);
+      if(nrm>Dtype(0))
+        caffe_scal(dim, Dtype(1)/nrm, label+i*dim);
+    }
   }
-  for (int i=0;i<num;i++){
-    Dtype nrm;
-    caffe_nrm2(dim, label+i*dim,&nrm); 
-    caffe_axpy(dim, Dtype(1)/nrm, label+i*dim, mutable_label+i*dim);
+  const RankHingeParameter_NegativeMining mining =
+    this->layer_param_.rank_hinge_param().negative_mining();
+  if(mining!=RankHingeParameter_NegativeMining_RANDOM){
+    // score of every embedding against every label vector in one GEMM
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim, Dtype(1),
+        dptr, label, Dtype(0), scores_.mutable_cpu_data());
   }
   Dtype loss=Dtype(0);
   for (int i = 0; i < num; ++i) {
     int irrelevant_idx, tmpcount=0;
-    while(true){
+    if(mining!=RankHingeParameter_NegativeMining_RANDOM){
+      irrelevant_idx=MineNegative(bottom, i);
+      if(irrelevant_idx<0){
+        // every other example shares a label with the anchor
+        caffe_set(dim, Dtype(0), bottom_diff+i*dim);
+        continue;
+      }
+    }else while(true){
       tmpcount++;
       irrelevant_idx=caffe_rng_rand()%num;
       if(label_vec_.channels()==2){
@@ -87,15 +167,13 @@ void RankHingeLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       }else if(irrelevant_idx!=i)
         break;
     }
-    caffe_sub(dim, mutable_label+irrelevant_idx*dim, mutable_label+i*dim, bottom_diff+i*dim);
+    caffe_sub(dim, label+irrelevant_idx*dim, label+i*dim, bottom_diff+i*dim);
     Dtype tmp = caffe_cpu_dot(dim, dptr+i*dim, bottom_diff+i*dim);
     if(margin_+tmp>0)
       loss+=margin_+tmp;
     else
       caffe_set(dim, Dtype(0), bottom_diff+i*dim);
   }
-  if(label_vec_.count()>0)
-    delete label;
   *(*top)[0]->mutable_cpu_data()=loss/num;
 }
 
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/evaluator.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void RetrievalMAPLayer<Dtype>::LayerSetUp(
+  const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const RetrievalMAPParameter& param = this->layer_param_.retrieval_map_param();
+  num_batches_ = param.num_batches();
+  top_k_ = param.top_k();
+  num_queries_ = param.num_queries();
+  CHECK_GT(num_batches_, 0) << "Set retrieval_map_param.num_batches to the "
+      << "number of TEST iterations";
+  CHECK_GE(top_k_, 0);
+  CHECK_GT(num_queries_, 0);
+  batch_ = 0;
+  num_points_ = 0;
+  searcher_.reset(new evaluator::Searcher<Dtype>());
+}
+
+template <typename Dtype>
+void RetrievalMAPLayer<Dtype>::Reshape(
+  const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Blob<Dtype>& db = *bottom[bottom.size() - 2];
+  const Blob<Dtype>& label = *bottom.back();
+  CHECK_EQ(bottom[0]->num(), label.num());
+  CHECK_EQ(db.num(), label.num());
+  CHECK_EQ(bottom[0]->count(), db.count())
+      << "Query and database embeddings must have the same dimension";
+  int capacity = num_batches_ * label.num();
+  const int max_points =
+      this->layer_param_.retrieval_map_param().max_points();
+  if (max_points > 0) {
+    capacity = std::min(capacity, max_points);
+  }
+  // Blob::Reshape keeps the buffered rows as long as the shape is unchanged.
+  const int dim = db.count() / db.num();
+  db_buffer_.Reshape(capacity, dim, 1, 1);
+  if (bottom.size() > 2) {
+    query_buffer_.Reshape(capacity, dim, 1, 1);
+  }
+  label_buffer_.Reshape(capacity, label.count() / label.num(), 1, 1);
+  // MAP@k and precision@k
+  (*top)[0]->Reshape(2, 1, 1, 1);
+}
+
+template <typename Dtype>
+void RetrievalMAPLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  const Blob<Dtype>& db = *bottom[bottom.size() - 2];
+  const Blob<Dtype>& label = *bottom.back();
+  const int dim = db_buffer_.channels();
+  const int label_dim = label_buffer_.channels();
+  const int rows = std::min(label.num(), db_buffer_.num() - num_points_);
+  caffe_copy(rows * dim, db.cpu_data(),
+      db_buffer_.mutable_cpu_data() + num_points_ * dim);
+  if (bottom.size() > 2) {
+    caffe_copy(rows * dim, bottom[0]->cpu_data(),
+        query_buffer_.mutable_cpu_data() + num_points_ * dim);
+  }
+  caffe_copy(rows * label_dim, label.cpu_data(),
+      label_buffer_.mutable_cpu_data() + num_points_ * label_dim);
+  num_points_ += rows;
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  if (++batch_ < num_batches_) {
+    top_data[0] = top_data[1] = Dtype(0);
+    return;
+  }
+  const int num_queries = std::min(num_queries_, num_points_);
+  searcher_->SetupGroundTruth(num_queries, num_points_, label_dim,
+      label_buffer_.cpu_data());
+  if (bottom.size() > 2) {
+    searcher_->Search(query_buffer_.cpu_data(), db_buffer_.cpu_data(), dim);
+  } else {
+    searcher_->Search(db_buffer_.cpu_data(), dim);
+  }
+  const int top_k = top_k_ > 0 ? std::min(top_k_, num_points_) : num_points_;
+  top_data[0] = searcher_->GetMAP(NULL, top_k) * num_batches_;
+  top_data[1] = searcher_->GetPrecision(NULL, top_k) * num_batches_;
+  batch_ = 0;
+  num_points_ = 0;
+}
+
+INSTANTIATE_CLASS(RetrievalMAPLayer);
+
+}  // namespace caffe
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cfloat>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -8,106 +9,103 @@
 
 namespace caffe {
 
-template <typename Dtype>
-void SoftmaxMultiLabelLossLayer<Dtype>::LayerSetUp(
-    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  LossLayer<Dtype>::LayerSetUp(bottom, top);
-  softmax_bottom_vec_.clear();
-  softmax_bottom_vec_.push_back(bottom[0]);
-  softmax_top_vec_.clear();
-  softmax_top_vec_.push_back(&prob_);
-  softmax_layer_->SetUp(softmax_bottom_vec_, &softmax_top_vec_);
-}
-
 template <typename Dtype>
 void SoftmaxMultiLabelLossLayer<Dtype>::Reshape(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   LossLayer<Dtype>::Reshape(bottom, top);
-  softmax_layer_->Reshape(softmax_bottom_vec_, &softmax_top_vec_);
+  CHECK_EQ(bottom[0]->height() * bottom[0]->width(), 1);
+  const int num = bottom[0]->num();
+  log_sum_exp_.Reshape(num, 1, 1, 1);
+  row_loss_.Reshape(num, 1, 1, 1);
+  label_offset_.Reshape(num + 1, 1, 1, 1);
   if (top->size() >= 2) {
-    // softmax output
-    //(*top)[1]->ReshapeLike(*bottom[0]);
-    (*top)[1]->Reshape(bottom[0]->num(),1,1,1);
+    // loss of every example
+    (*top)[1]->Reshape(num, 1, 1, 1);
+  }
+}
+
+template <typename Dtype>
+void SoftmaxMultiLabelLossLayer<Dtype>::DecodeLabels(
+    const Blob<Dtype>& label, const int dim) {
+  labels_.FromBlob(label);
+  CHECK_LE(labels_.num_classes(), dim);
+  for (int i = 0; i < labels_.num(); ++i) {
+    CHECK_GT(labels_.size(i), 0) << "image has no label";
   }
 }
 
 template <typename Dtype>
 void SoftmaxMultiLabelLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, &softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
-  const Dtype* label = bottom[1]->cpu_data();
-  int num = prob_.num();
-  int dim = prob_.count() / num;
-  int spatial_dim = prob_.height() * prob_.width();
-  int label_dim = bottom[1]->count()/num;
-  Dtype* toploss;
-  if(top->size()>1)
-    toploss=(*top)[1]->mutable_cpu_data();
-  CHECK_EQ(spatial_dim, 1);
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  DecodeLabels(*bottom[1], dim);
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const int* offset = labels_.offsets();
+  const int* index = labels_.ids();
+  Dtype* log_sum_exp = log_sum_exp_.mutable_cpu_data();
+  Dtype* row_loss = row_loss_.mutable_cpu_data();
+  // -log(p) is capped at -log(FLT_MIN), like the log(max(p, FLT_MIN)) of
+  // the other softmax losses.
+  const Dtype max_loss = -log(Dtype(FLT_MIN));
   Dtype loss = 0;
-  if(num_labels_.size()==0)
-    num_labels_.resize(num);
-  else
-    CHECK_EQ(num_labels_.size(), num);
   for (int i = 0; i < num; ++i) {
-    Dtype tmp_loss=0;
-    int labelon=0;
-    for( int j=0; label[i*label_dim+j]!=-1&&j<label_dim;++j){
-      tmp_loss -= log(std::max(prob_data[i * dim +
-          static_cast<int>(label[i * label_dim+j])], Dtype(FLT_MIN)));
-      labelon+=1;
+    const Dtype* x = bottom_data + i * dim;
+    const Dtype maxval = *std::max_element(x, x + dim);
+    Dtype sum = 0;
+    for (int c = 0; c < dim; ++c) {
+      sum += exp(x[c] - maxval);
+    }
+    log_sum_exp[i] = maxval + log(sum);
+    Dtype tmp_loss = 0;
+    for (int k = offset[i]; k < offset[i + 1]; ++k) {
+      tmp_loss += std::min(log_sum_exp[i] - x[index[k]], max_loss);
     }
-    CHECK_GT(labelon, 0)<<"image has no label";
-    loss+=tmp_loss/labelon;
-    if(top->size()>1)
-      toploss[i]=tmp_loss/labelon;
-    num_labels_[i]=labelon;
+    row_loss[i] = tmp_loss / (offset[i + 1] - offset[i]);
+    loss += row_loss[i];
   }
-  (*top)[0]->mutable_cpu_data()[0] = loss / num ;
-  /*
-  if (top->size() == 2) {
-    (*top)[1]->ShareData(prob_);
+  (*top)[0]->mutable_cpu_data()[0] = loss / num;
+  if (top->size() >= 2) {
+    caffe_copy(num, row_loss, (*top)[1]->mutable_cpu_data());
   }
-  */
 }
 
 template <typename Dtype>
-void SoftmaxMultiLabelLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-    const vector<bool>& propagate_down,
+void SoftmaxMultiLabelLossLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     vector<Blob<Dtype>*>* bottom) {
   if (propagate_down[1]) {
     LOG(FATAL) << this->type_name()
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
+    const Dtype* bottom_data = (*bottom)[0]->cpu_data();
     Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-    const Dtype* prob_data = prob_.cpu_data();
-    caffe_copy(prob_.count(), prob_data, bottom_diff);
-    const Dtype* label = (*bottom)[1]->cpu_data();
-    int num = prob_.num();
-    int dim = prob_.count() / num;
-    int spatial_dim = prob_.height() * prob_.width();
-    int label_dim = (*bottom)[1]->count()/num;
-    CHECK_EQ(spatial_dim, 1);
+    const int* offset = labels_.offsets();
+    const int* index = labels_.ids();
+    const Dtype* log_sum_exp = log_sum_exp_.cpu_data();
+    const int num = (*bottom)[0]->num();
+    const int dim = (*bottom)[0]->count() / num;
+    const Dtype scale = top[0]->cpu_diff()[0] / num;
     for (int i = 0; i < num; ++i) {
-      for( int j=0;label[i*label_dim+j]!=-1&&j<label_dim;++j)
-        bottom_diff[i * dim + static_cast<int>(label[i * label_dim + j])] -=
-          1.0/num_labels_[i];
+      // (softmax - label distribution) * scale, in one pass over the row
+      Dtype* diff = bottom_diff + i * dim;
+      const Dtype* x = bottom_data + i * dim;
+      for (int c = 0; c < dim; ++c) {
+        diff[c] = scale * exp(x[c] - log_sum_exp[i]);
+      }
+      const Dtype label_weight = scale / (offset[i + 1] - offset[i]);
+      for (int k = offset[i]; k < offset[i + 1]; ++k) {
+        diff[index[k]] -= label_weight;
+      }
     }
-    // Scale gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    caffe_scal(prob_.count(), loss_weight / num , bottom_diff);
   }
 }
 
-
 #ifdef CPU_ONLY
 STUB_GPU(SoftmaxMultiLabelLossLayer);
 #endif
 
 INSTANTIATE_CLASS(SoftmaxMultiLabelLossLayer);
 
-
 }  // namespace caffe
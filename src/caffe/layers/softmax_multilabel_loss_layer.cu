@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per example: log-sum-exp of the row and its averaged label loss.
+template <typename Dtype>
+__global__ void SoftmaxMultiLabelLossForward(const int num, const int dim,
+    const Dtype* bottom_data, const int* offset, const int* index,
+    const Dtype max_loss, Dtype* log_sum_exp, Dtype* row_loss) {
+  CUDA_KERNEL_LOOP(n, num) {
+    const Dtype* x = bottom_data + n * dim;
+    Dtype maxval = x[0];
+    for (int c = 1; c < dim; ++c) {
+      maxval = max(maxval, x[c]);
+    }
+    Dtype sum = 0;
+    for (int c = 0; c < dim; ++c) {
+      sum += exp(x[c] - maxval);
+    }
+    log_sum_exp[n] = maxval + log(sum);
+    Dtype loss = 0;
+    for (int k = offset[n]; k < offset[n + 1]; ++k) {
+      loss += min(log_sum_exp[n] - x[index[k]], max_loss);
+    }
+    row_loss[n] = loss / (offset[n + 1] - offset[n]);
+  }
+}
+
+template <typename Dtype>
+void SoftmaxMultiLabelLossLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  DecodeLabels(*bottom[1], dim);
+  label_index_.Reshape(labels_.nnz(), 1, 1, 1);
+  std::copy(labels_.offsets(), labels_.offsets() + num + 1,
+      label_offset_.mutable_cpu_data());
+  std::copy(labels_.ids(), labels_.ids() + labels_.nnz(),
+      label_index_.mutable_cpu_data());
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SoftmaxMultiLabelLossForward<Dtype><<<CAFFE_GET_BLOCKS(num),
+      CAFFE_CUDA_NUM_THREADS>>>(num, dim, bottom[0]->gpu_data(),
+      label_offset_.gpu_data(), label_index_.gpu_data(),
+      -log(Dtype(FLT_MIN)), log_sum_exp_.mutable_gpu_data(),
+      row_loss_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  Dtype loss;
+  // row losses are non-negative
+  caffe_gpu_asum(num, row_loss_.gpu_data(), &loss);
+  (*top)[0]->mutable_cpu_data()[0] = loss / num;
+  if (top->size() >= 2) {
+    caffe_copy(num, row_loss_.gpu_data(), (*top)[1]->mutable_gpu_data());
+  }
+}
+
+template <typename Dtype>
+__global__ void SoftmaxMultiLabelLossBackward(const int count, const int dim,
+    const Dtype scale, const Dtype* bottom_data, const Dtype* log_sum_exp,
+    const int* offset, const int* index, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const int n = i / dim;
+    const int c = i % dim;
+    Dtype diff = exp(bottom_data[i] - log_sum_exp[n]);
+    for (int k = offset[n]; k < offset[n + 1]; ++k) {
+      if (index[k] == c) {
+        diff -= Dtype(1) / (offset[n + 1] - offset[n]);
+      }
+    }
+    bottom_diff[i] = scale * diff;
+  }
+}
+
+template <typename Dtype>
+void SoftmaxMultiLabelLossLayer<Dtype>::Backward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    vector<Blob<Dtype>*>* bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type_name()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (propagate_down[0]) {
+    const int count = (*bottom)[0]->count();
+    const int num = (*bottom)[0]->num();
+    const Dtype scale = top[0]->cpu_diff()[0] / num;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    SoftmaxMultiLabelLossBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, count / num, scale,
+        (*bottom)[0]->gpu_data(), log_sum_exp_.gpu_data(),
+        label_offset_.gpu_data(), label_index_.gpu_data(),
+        (*bottom)[0]->mutable_gpu_diff());
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+INSTANTIATE_CLASS(SoftmaxMultiLabelLossLayer);
+
+}  // namespace caffe
@@ -44,20 +44,18 @@ void WeightedEuclideanLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>&
       const Dtype sign = (i == 0) ? 1 : -1;
       const Dtype alpha = sign * top[0]->cpu_diff()[0] / (*bottom)[i]->num();
       if(bottom->size()>3){
+        // only the side with the larger loss of each pair is updated; decide
+        // once per row, then scale the whole batch in one masked pass
         const Dtype* loss2=(*bottom)[2]->cpu_data();
         const Dtype* loss3=(*bottom)[3]->cpu_data();
+        const Dtype* diff=diff_.cpu_data();
+        Dtype* bottom_diff=(*bottom)[i]->mutable_cpu_diff();
         int num=(*bottom)[i]->num();
         int dim=(*bottom)[i]->count()/num;
-        Dtype local_alpha=alpha;
         for(int j=0;j<num;j++){
-          if(sign*(loss2[j]-loss3[j])<=0)
-            local_alpha=Dtype(0);
-          caffe_cpu_axpby(
-              dim, 
-              local_alpha,                       
-              diff_.cpu_data()+j*dim,     
-              Dtype(0),                  
-              (*bottom)[i]->mutable_cpu_diff()+j*dim);
+          const Dtype row_alpha=sign*(loss2[j]-loss3[j])>0?alpha:Dtype(0);
+          for(int k=j*dim;k<(j+1)*dim;k++)
+            bottom_diff[k]=row_alpha*diff[k];
         }
       }else{
         caffe_cpu_axpby(
@@ -22,6 +22,17 @@ void WeightedEuclideanLossLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>&
   (*top)[0]->mutable_cpu_data()[0] = loss;
 }
 
+// alpha * diff on the rows where sign * (loss2 - loss3) > 0, zero elsewhere.
+template <typename Dtype>
+__global__ void GatedEuclideanBackward(const int count, const int dim,
+    const Dtype alpha, const Dtype sign, const Dtype* loss2,
+    const Dtype* loss3, const Dtype* diff, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const int n = i / dim;
+    bottom_diff[i] = sign * (loss2[n] - loss3[n]) > 0 ? alpha * diff[i] : 0;
+  }
+}
+
 template <typename Dtype>
 void WeightedEuclideanLossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
@@ -30,21 +41,13 @@ void WeightedEuclideanLossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>&
       const Dtype sign = (i == 0) ? 1 : -1;
       const Dtype alpha = sign * top[0]->cpu_diff()[0] / (*bottom)[i]->num();
       if(bottom->size()>3){
-        const Dtype* loss2=(*bottom)[2]->cpu_data();
-        const Dtype* loss3=(*bottom)[3]->cpu_data();
-        int num=(*bottom)[i]->num();
-        int dim=(*bottom)[i]->count()/num;
-        Dtype local_alpha=alpha;
-        for(int j=0;j<num;j++){
-          if(sign*(loss2[j]-loss3[j])<=0)
-            local_alpha=Dtype(0);
-          caffe_gpu_axpby(
-              dim, 
-              local_alpha,                       
-              diff_.gpu_data()+j*dim,     
-              Dtype(0),                  
-              (*bottom)[i]->mutable_gpu_diff()+j*dim);
-        }
+        const int count=(*bottom)[i]->count();
+        // NOLINT_NEXT_LINE(whitespace/operators)
+        GatedEuclideanBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+            CAFFE_CUDA_NUM_THREADS>>>(count, count/(*bottom)[i]->num(),
+            alpha, sign, (*bottom)[2]->gpu_data(), (*bottom)[3]->gpu_data(),
+            diff_.gpu_data(), (*bottom)[i]->mutable_gpu_diff());
+        CUDA_POST_KERNEL_CHECK;
       }else{
         caffe_gpu_axpby(
             (*bottom)[i]->count(),              // count
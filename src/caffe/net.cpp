@@ -5,10 +5,16 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+
 #include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -30,12 +36,31 @@ Net<Dtype>::Net(const string& param_file) {
   Init(param);
 }
 
+template <typename Dtype>
+Net<Dtype>::~Net() {
+  for (int i = 0; i < workers_.size(); ++i) {
+    ready_layers_.push(-1);
+  }
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->join();
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::Init(const NetParameter& in_param) {
+  host_system_allocs_ = 0;
+  host_pool_allocs_ = 0;
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  // Fold the layers that are redundant at inference into their neighbours.
+  const bool test_phase = in_param.state().has_phase() ?
+      in_param.state().phase() == TEST : Caffe::phase() == Caffe::TEST;
+  if (in_param.fuse_layers() && test_phase) {
+    const NetParameter unfused_param(filtered_param);
+    FuseLayers(unfused_param, &filtered_param);
+  }
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
   // Create a copy of filtered_param with splits added where necessary.
@@ -216,12 +241,454 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   GetLearningRateAndWeightDecay();
+  InitFeatureCaches(param);
+  activations_shared_ = false;
+  if (param.share_activations() && test_phase) {
+    ShareActivations(param);
+  }
+  InitScheduler(param);
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   // Don't display debug info by default.
   debug_info_ = false;
 }
 
+template <typename Dtype>
+void Net<Dtype>::ShareActivations(const NetParameter& param) {
+  // Blobs sharing their data are planned as one: those sharing it already,
+  // and the tops of split and flatten layers, which only point at their
+  // bottom's data once Forward runs. A group is live from the first to the
+  // last layer it is a bottom or top of.
+  map<SyncedMemory*, int> memory_to_blob;
+  vector<int> blob_root(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    SyncedMemory* memory = blobs_[blob_id]->data().get();
+    if (!memory_to_blob.count(memory)) {
+      memory_to_blob[memory] = blob_id;
+    }
+    blob_root[blob_id] = memory_to_blob[memory];
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerParameter_LayerType type = layers_[layer_id]->type();
+    if (type != LayerParameter_LayerType_SPLIT &&
+        type != LayerParameter_LayerType_FLATTEN) {
+      continue;
+    }
+    const int root = blob_root[bottom_id_vecs_[layer_id][0]];
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int top_root = blob_root[top_id_vecs_[layer_id][i]];
+      for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+        if (blob_root[blob_id] == top_root) {
+          blob_root[blob_id] = root;
+        }
+      }
+    }
+  }
+  map<int, int> root_to_group;
+  vector<int> blob_group(blobs_.size());
+  vector<size_t> group_size;
+  vector<int> group_first, group_last;
+  vector<bool> group_pinned;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int root = blob_root[blob_id];
+    if (!root_to_group.count(root)) {
+      root_to_group[root] = group_size.size();
+      group_size.push_back(0);
+      group_first.push_back(layers_.size());
+      group_last.push_back(-1);
+      group_pinned.push_back(false);
+    }
+    const int group = root_to_group[root];
+    blob_group[blob_id] = group;
+    group_size[group] = std::max(group_size[group],
+        blobs_[blob_id]->count() * sizeof(Dtype));
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int group = blob_group[bottom_id_vecs_[layer_id][i]];
+      group_first[group] = std::min(group_first[group], layer_id);
+      group_last[group] = std::max(group_last[group], layer_id);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int group = blob_group[top_id_vecs_[layer_id][i]];
+      group_first[group] = std::min(group_first[group], layer_id);
+      group_last[group] = std::max(group_last[group], layer_id);
+      // The tops of layers without bottoms, like data layers, may be filled
+      // once at setup.
+      if (bottom_id_vecs_[layer_id].size() == 0) {
+        group_pinned[group] = true;
+      }
+    }
+  }
+  // The inputs and outputs of the net, and the blobs asked for, keep their
+  // own memory.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    group_pinned[blob_group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    group_pinned[blob_group[net_output_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(has_blob(param.keep_blob(i))) << "Unknown blob to keep "
+        << param.keep_blob(i);
+    group_pinned[blob_group[blob_names_index_[param.keep_blob(i)]]] = true;
+  }
+  // Assign the groups, in the order they come alive, to buffers no longer
+  // in use: the smallest one large enough, or else the largest one, grown.
+  vector<pair<int, int> > order;
+  for (int group = 0; group < group_size.size(); ++group) {
+    if (!group_pinned[group] && group_last[group] >= 0) {
+      order.push_back(make_pair(group_first[group], group));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  vector<size_t> buffer_size;
+  vector<int> buffer_last;
+  vector<int> group_buffer(group_size.size(), -1);
+  for (int i = 0; i < order.size(); ++i) {
+    const int group = order[i].second;
+    int best = -1;
+    for (int buffer = 0; buffer < buffer_size.size(); ++buffer) {
+      if (buffer_last[buffer] >= group_first[group]) {
+        continue;
+      }
+      if (best < 0) {
+        best = buffer;
+        continue;
+      }
+      const bool fits = buffer_size[buffer] >= group_size[group];
+      const bool best_fits = buffer_size[best] >= group_size[group];
+      if (fits ? !best_fits || buffer_size[buffer] < buffer_size[best] :
+          !best_fits && buffer_size[buffer] > buffer_size[best]) {
+        best = buffer;
+      }
+    }
+    if (best < 0) {
+      best = buffer_size.size();
+      buffer_size.push_back(0);
+      buffer_last.push_back(-1);
+    }
+    buffer_size[best] = std::max(buffer_size[best], group_size[group]);
+    buffer_last[best] = group_last[group];
+    group_buffer[group] = best;
+  }
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_size.size());
+  size_t memory_used = 0;
+  for (int buffer = 0; buffer < buffer_size.size(); ++buffer) {
+    buffers[buffer].reset(new SyncedMemory(buffer_size[buffer]));
+    memory_used += buffer_size[buffer];
+  }
+  for (int group = 0; group < group_size.size(); ++group) {
+    if (group_pinned[group]) {
+      memory_used += group_size[group];
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int buffer = group_buffer[blob_group[blob_id]];
+    if (buffer >= 0) {
+      blobs_[blob_id]->ShareData(buffers[buffer]);
+    }
+  }
+  activations_shared_ = true;
+  memory_used_ = memory_used / sizeof(Dtype);
+  LOG(INFO) << "Sharing " << order.size() << " activations in "
+            << buffers.size() << " buffers";
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitFeatureCaches(const NetParameter& param) {
+  // The layer which last wrote each bottom before it was read, or -1 for the
+  // inputs of the net, and the layer which last wrote each blob.
+  vector<vector<int> > bottom_writer_ids(layers_.size());
+  vector<int> last_writer_ids(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      bottom_writer_ids[layer_id].push_back(
+          last_writer_ids[bottom_id_vecs_[layer_id][i]]);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      last_writer_ids[top_id_vecs_[layer_id][i]] = layer_id;
+    }
+  }
+  layer_cache_ids_.assign(layers_.size(), -1);
+  for (int cache_id = 0; cache_id < param.feature_cache_size(); ++cache_id) {
+    const FeatureCacheParameter& cache_param = param.feature_cache(cache_id);
+    CHECK(has_layer(cache_param.layer()))
+        << "Unknown layer " << cache_param.layer() << " to cache";
+    const int cached_id = layer_names_index_[cache_param.layer()];
+    CHECK_EQ(top_vecs_[cached_id].size(), 1)
+        << "Layer " << cache_param.layer() << " must have one top to cache";
+    // The frozen sub-graph is the cached layer and the layers it depends on,
+    // up to the data layer whose records they are computed from.
+    vector<bool> frozen(layers_.size(), false);
+    frozen[cached_id] = true;
+    int source_id = -1;
+    for (int layer_id = cached_id; layer_id >= 0; --layer_id) {
+      if (!frozen[layer_id]) {
+        continue;
+      }
+      CHECK(bottom_vecs_[layer_id].size())
+          << "Layer " << layer_names_[layer_id] << " has no bottom to cache";
+      for (int i = 0; i < bottom_writer_ids[layer_id].size(); ++i) {
+        const int writer_id = bottom_writer_ids[layer_id][i];
+        CHECK_GE(writer_id, 0) << "Layer " << layer_names_[layer_id]
+            << " reads an input of the net, so its outputs cannot be cached";
+        if (bottom_vecs_[writer_id].size()) {
+          frozen[writer_id] = true;
+          continue;
+        }
+        CHECK(source_id < 0 || source_id == writer_id)
+            << "The outputs of " << cache_param.layer()
+            << " depend on several data layers";
+        source_id = writer_id;
+      }
+    }
+    CHECK(dynamic_cast<BasePrefetchingDataLayer<Dtype>*>(
+        layers_[source_id].get()))
+        << "Layer " << layer_names_[source_id]
+        << " does not give the keys of its records to cache by";
+    // Skipping the sub-graph must change nothing but its own blobs.
+    int num_frozen = 0;
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      if (frozen[layer_id]) {
+        CHECK_LT(layer_cache_ids_[layer_id], 0) << "Layer "
+            << layer_names_[layer_id] << " is frozen for several caches";
+        CHECK(!layer_need_backward_[layer_id]) << "Layer "
+            << layer_names_[layer_id] << " needs backward, so its outputs "
+            << "cannot be cached; set its blobs_lr to 0";
+        for (int i = 0; i < top_vecs_[layer_id].size(); ++i) {
+          CHECK_EQ(layers_[layer_id]->loss(i), 0) << "Layer "
+              << layer_names_[layer_id] << " is a loss and cannot be cached";
+        }
+        layer_cache_ids_[layer_id] = cache_id;
+        ++num_frozen;
+        continue;
+      }
+      for (int i = 0; i < bottom_writer_ids[layer_id].size(); ++i) {
+        const int writer_id = bottom_writer_ids[layer_id][i];
+        CHECK(writer_id < 0 || !frozen[writer_id] || writer_id == cached_id)
+            << "Layer " << layer_names_[layer_id] << " reads "
+            << blob_names_[bottom_id_vecs_[layer_id][i]]
+            << " from inside the sub-graph cached at " << cache_param.layer();
+      }
+    }
+    for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+      const int writer_id = last_writer_ids[net_output_blob_indices_[i]];
+      CHECK(writer_id < 0 || !frozen[writer_id] || writer_id == cached_id)
+          << "The net outputs " << blob_names_[net_output_blob_indices_[i]]
+          << " from inside the sub-graph cached at " << cache_param.layer();
+    }
+    const Blob<Dtype>* top = top_vecs_[cached_id][0];
+    feature_caches_.push_back(shared_ptr<FeatureCache<Dtype> >(
+        new FeatureCache<Dtype>(cache_param.source(),
+                                top->count() / top->num())));
+    cache_layer_ids_.push_back(cached_id);
+    cache_source_ids_.push_back(source_id);
+    cache_features_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(
+        top->num(), top->channels(), top->height(), top->width())));
+    memory_used_ += top->count();
+    // Nothing is cached before the first batch.
+    cache_misses_.push_back(vector<int>(1, 0));
+    LOG(INFO) << "Caching " << cache_param.layer() << " per record of "
+              << layer_names_[source_id] << ", which saves running "
+              << num_frozen << " layers";
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::GetCachedFeatures(const int cache_id) {
+  const vector<string>& keys = static_cast<BasePrefetchingDataLayer<Dtype>*>(
+      layers_[cache_source_ids_[cache_id]].get())->keys();
+  Blob<Dtype>* features = cache_features_[cache_id].get();
+  CHECK_EQ(keys.size(), features->num())
+      << "Layer " << layer_names_[cache_source_ids_[cache_id]]
+      << " gave no key for some of its records";
+  const int dim = feature_caches_[cache_id]->dim();
+  Dtype* feature_data = features->mutable_cpu_data();
+  cache_misses_[cache_id].clear();
+  for (int i = 0; i < keys.size(); ++i) {
+    if (!feature_caches_[cache_id]->Get(keys[i], feature_data + i * dim)) {
+      cache_misses_[cache_id].push_back(i);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PutCachedFeatures(const int cache_id) {
+  const vector<string>& keys = static_cast<BasePrefetchingDataLayer<Dtype>*>(
+      layers_[cache_source_ids_[cache_id]].get())->keys();
+  const Blob<Dtype>* top = top_vecs_[cache_layer_ids_[cache_id]][0];
+  CHECK_EQ(top->count(), cache_features_[cache_id]->count())
+      << "The top of " << layer_names_[cache_layer_ids_[cache_id]]
+      << " changed shape since it was cached";
+  const int dim = feature_caches_[cache_id]->dim();
+  const Dtype* top_data = top->cpu_data();
+  const vector<int>& misses = cache_misses_[cache_id];
+  for (int i = 0; i < misses.size(); ++i) {
+    feature_caches_[cache_id]->Put(keys[misses[i]],
+                                   top_data + misses[i] * dim);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitScheduler(const NetParameter& param) {
+  // Between forward and backward, a layer reads the data of its bottoms, the
+  // diffs of its tops and its parameters, and writes the data of its tops and
+  // the diffs of its bottoms and parameters. A layer depends on the earlier
+  // layers writing memory it touches, or touching memory it writes, so that
+  // any schedule honouring these dependencies gives the results of running
+  // the layers in order.
+  vector<set<const void*> > reads(layers_.size());
+  vector<set<const void*> > writes(layers_.size());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_vecs_[layer_id].size(); ++i) {
+      reads[layer_id].insert(bottom_vecs_[layer_id][i]->data().get());
+      writes[layer_id].insert(bottom_vecs_[layer_id][i]->diff().get());
+    }
+    for (int i = 0; i < top_vecs_[layer_id].size(); ++i) {
+      writes[layer_id].insert(top_vecs_[layer_id][i]->data().get());
+      reads[layer_id].insert(top_vecs_[layer_id][i]->diff().get());
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& layer_blobs =
+        layers_[layer_id]->blobs();
+    for (int i = 0; i < layer_blobs.size(); ++i) {
+      reads[layer_id].insert(layer_blobs[i]->data().get());
+      writes[layer_id].insert(layer_blobs[i]->diff().get());
+    }
+  }
+  layer_successors_.assign(layers_.size(), vector<int>());
+  layer_predecessors_.assign(layers_.size(), vector<int>());
+  for (int j = 0; j < layers_.size(); ++j) {
+    for (int i = 0; i < j; ++i) {
+      bool conflict = false;
+      for (set<const void*>::const_iterator it = writes[i].begin();
+           !conflict && it != writes[i].end(); ++it) {
+        conflict = reads[j].count(*it) || writes[j].count(*it);
+      }
+      for (set<const void*>::const_iterator it = reads[i].begin();
+           !conflict && it != reads[i].end(); ++it) {
+        conflict = writes[j].count(*it);
+      }
+      if (conflict) {
+        layer_successors_[i].push_back(j);
+        layer_predecessors_[j].push_back(i);
+      }
+    }
+  }
+  layer_losses_.resize(layers_.size());
+  for (int i = 0; i < param.num_threads(); ++i) {
+    workers_.push_back(shared_ptr<boost::thread>(new boost::thread(
+        boost::bind(&Net<Dtype>::WorkerEntry, this))));
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunLayer(const int layer_id, const bool forward) {
+  if (forward) {
+    const int cache_id = layer_cache_ids_[layer_id];
+    if (cache_id >= 0 && cache_misses_[cache_id].empty()) {
+      // Every record of the batch is cached: the frozen sub-graph is skipped
+      // and the cached layer outputs the cached features.
+      if (layer_id == cache_layer_ids_[cache_id]) {
+        Blob<Dtype>* top = top_vecs_[layer_id][0];
+        caffe_copy(top->count(), cache_features_[cache_id]->cpu_data(),
+                   top->mutable_cpu_data());
+      }
+      layer_losses_[layer_id] = 0;
+      return;
+    }
+    layers_[layer_id]->Reshape(bottom_vecs_[layer_id], &top_vecs_[layer_id]);
+    layer_losses_[layer_id] =
+        layers_[layer_id]->Forward(bottom_vecs_[layer_id],
+                                   &top_vecs_[layer_id]);
+    if (cache_id >= 0 && layer_id == cache_layer_ids_[cache_id]) {
+      PutCachedFeatures(cache_id);
+    }
+    for (int i = 0; i < cache_source_ids_.size(); ++i) {
+      if (cache_source_ids_[i] == layer_id) {
+        GetCachedFeatures(i);
+      }
+    }
+  } else if (layer_need_backward_[layer_id]) {
+    layers_[layer_id]->Backward(top_vecs_[layer_id],
+        bottom_need_backward_[layer_id], &bottom_vecs_[layer_id]);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::WorkerEntry() {
+  while (true) {
+    const int layer_id = ready_layers_.pop();
+    if (layer_id < 0) {
+      return;
+    }
+    // The Caffe singleton is per thread.
+    Caffe::set_mode(workers_mode_);
+    Caffe::set_phase(workers_phase_);
+    RunLayer(layer_id, workers_forward_);
+    done_layers_.push(layer_id);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RunScheduled(const int start, const int end,
+    const bool forward) {
+  if (forward ? start > end : start < end) {
+    return;
+  }
+  const int step = forward ? 1 : -1;
+  // In backward, a layer waits for the layers depending on it in forward.
+  const vector<vector<int> >& waits_for =
+      forward ? layer_predecessors_ : layer_successors_;
+  const vector<vector<int> >& waited_by =
+      forward ? layer_successors_ : layer_predecessors_;
+  const int first = std::min(start, end);
+  const int last = std::max(start, end);
+  vector<int> num_waiting(layers_.size(), 0);
+  for (int layer_id = first; layer_id <= last; ++layer_id) {
+    for (int i = 0; i < waits_for[layer_id].size(); ++i) {
+      const int other_id = waits_for[layer_id][i];
+      num_waiting[layer_id] += other_id >= first && other_id <= last;
+    }
+  }
+  workers_forward_ = forward;
+  workers_mode_ = Caffe::mode();
+  workers_phase_ = Caffe::phase();
+  for (int layer_id = start; layer_id != end + step; layer_id += step) {
+    if (!num_waiting[layer_id] && layers_[layer_id]->AllowConcurrentRun()) {
+      ready_layers_.push(layer_id);
+    }
+  }
+  // The layers which may not run concurrently run here, in order.
+  int next_id = start;
+  while (next_id != end + step && layers_[next_id]->AllowConcurrentRun()) {
+    next_id += step;
+  }
+  for (int num_left = last - first + 1; num_left > 0; --num_left) {
+    int done_id;
+    if (next_id != end + step && !num_waiting[next_id]) {
+      RunLayer(next_id, forward);
+      done_id = next_id;
+      do {
+        next_id += step;
+      } while (next_id != end + step &&
+               layers_[next_id]->AllowConcurrentRun());
+    } else {
+      done_id = done_layers_.pop();
+    }
+    for (int i = 0; i < waited_by[done_id].size(); ++i) {
+      const int other_id = waited_by[done_id][i];
+      if (other_id < first || other_id > last) {
+        continue;
+      }
+      if (!--num_waiting[other_id] &&
+          layers_[other_id]->AllowConcurrentRun()) {
+        ready_layers_.push(other_id);
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -264,6 +731,21 @@ void Net<Dtype>::FilterNet(const NetParameter& param,
       param_filtered->add_layers()->CopyFrom(layer_param);
     }
   }
+  param_filtered->clear_feature_cache();
+  for (int i = 0; i < param.feature_cache_size(); ++i) {
+    const FeatureCacheParameter& cache_param = param.feature_cache(i);
+    bool cache_included = (cache_param.include_size() == 0 &&
+                           net_state.phase() == TRAIN);
+    for (int j = 0; !cache_included && j < cache_param.include_size(); ++j) {
+      if (StateMeetsRule(net_state, cache_param.include(j),
+                         cache_param.layer())) {
+        cache_included = true;
+      }
+    }
+    if (cache_included) {
+      param_filtered->add_feature_cache()->CopyFrom(cache_param);
+    }
+  }
 }
 
 template <typename Dtype>
@@ -501,14 +983,24 @@ template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  const HostMemoryStats host_stats = CaffeHostMemoryStats();
   Dtype loss = 0;
-  for (int i = start; i <= end; ++i) {
-    // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
-    Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
-    loss += layer_loss;
-    if (debug_info_) { ForwardDebugInfo(i); }
+  // Independent layers run concurrently on CPU; the losses are summed in
+  // order all the same.
+  if (workers_.size() && Caffe::mode() == Caffe::CPU && !debug_info_) {
+    RunScheduled(start, end, true);
+    for (int i = start; i <= end; ++i) {
+      loss += layer_losses_[i];
+    }
+  } else {
+    for (int i = start; i <= end; ++i) {
+      // LOG(ERROR) << "Forwarding " << layer_names_[i];
+      RunLayer(i, true);
+      loss += layer_losses_[i];
+      if (debug_info_) { ForwardDebugInfo(i); }
+    }
   }
+  CountHostAllocs(host_stats);
   return loss;
 }
 
@@ -565,15 +1057,32 @@ string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
 
 template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
+  CHECK(!activations_shared_)
+      << "Backward needs the activations, which share_activations overwrote.";
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
-  for (int i = start; i >= end; --i) {
-    if (layer_need_backward_[i]) {
-      layers_[i]->Backward(
-          top_vecs_[i], bottom_need_backward_[i], &bottom_vecs_[i]);
-      if (debug_info_) { BackwardDebugInfo(i); }
+  const HostMemoryStats host_stats = CaffeHostMemoryStats();
+  if (workers_.size() && Caffe::mode() == Caffe::CPU && !debug_info_) {
+    RunScheduled(start, end, false);
+  } else {
+    for (int i = start; i >= end; --i) {
+      if (layer_need_backward_[i]) {
+        layers_[i]->Backward(
+            top_vecs_[i], bottom_need_backward_[i], &bottom_vecs_[i]);
+        if (debug_info_) { BackwardDebugInfo(i); }
+      }
     }
   }
+  CountHostAllocs(host_stats);
+}
+
+template <typename Dtype>
+void Net<Dtype>::CountHostAllocs(const HostMemoryStats& before) {
+  // The counts are process-wide, so allocations made meanwhile by other
+  // threads, e.g. the prefetching ones, are counted too.
+  const HostMemoryStats after = CaffeHostMemoryStats();
+  host_system_allocs_ += after.system_allocs - before.system_allocs;
+  host_pool_allocs_ += after.pool_allocs - before.pool_allocs;
 }
 
 template <typename Dtype>
@@ -753,6 +1262,10 @@ void Net<Dtype>::Update() {
   for (int i = 0; i < params_.size(); ++i) {
     if (param_owners_[i] < 0) { continue; }
     if (debug_info_) { UpdateDebugInfo(i); }
+    // A diff never written adds nothing, and need not be allocated.
+    if (params_[i]->diff()->head() == SyncedMemory::UNINITIALIZED) {
+      continue;
+    }
     const int count = params_[i]->count();
     const Dtype* this_diff;
     Dtype* owner_diff;
@@ -156,6 +156,16 @@ void Solver<Dtype>::InitTestNets() {
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     test_nets_[i].reset(new Net<Dtype>(net_params[i]));
+    // RETRIEVAL_MAP scales its metric for Test's average over test_iter.
+    const vector<shared_ptr<Layer<Dtype> > >& layers = test_nets_[i]->layers();
+    for (int j = 0; j < layers.size(); ++j) {
+      const LayerParameter& layer_param = layers[j]->layer_param();
+      if (layer_param.type() == LayerParameter_LayerType_RETRIEVAL_MAP) {
+        CHECK_EQ(layer_param.retrieval_map_param().num_batches(),
+            param_.test_iter(i)) << "num_batches of " << layer_param.name()
+            << " must equal test_iter of test net #" << i;
+      }
+    }
   }
 }
 
@@ -215,6 +225,9 @@ void Solver<Dtype>::Solve(const char* resume_file) {
               << result_vec[k] << loss_msg_stream.str();
         }
       }
+      LOG(INFO) << "    Train net host allocations: "
+          << net_->host_system_allocs() << " from the system, "
+          << net_->host_pool_allocs() << " from the pool";
     }
 
     ComputeUpdateValue();
@@ -470,6 +483,13 @@ void SGDSolver<Dtype>::PreSolve() {
 }
 
 
+template <typename Dtype>
+bool SGDSolver<Dtype>::IsFrozen(const int param_id) {
+  return this->net_->params_lr()[param_id] == 0 &&
+      this->net_->params()[param_id]->diff()->head() ==
+      SyncedMemory::UNINITIALIZED;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue() {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -486,6 +506,7 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   switch (Caffe::mode()) {
   case Caffe::CPU:
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (IsFrozen(param_id)) { continue; }
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
@@ -522,6 +543,7 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   case Caffe::GPU:
 #ifndef CPU_ONLY
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (IsFrozen(param_id)) { continue; }
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
@@ -599,6 +621,7 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   switch (Caffe::mode()) {
   case Caffe::CPU:
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (this->IsFrozen(param_id)) { continue; }
       // save history momentum for stepping back
       caffe_copy(net_params[param_id]->count(),
           this->history_[param_id]->cpu_data(),
@@ -646,6 +669,7 @@ void NesterovSolver<Dtype>::ComputeUpdateValue() {
   case Caffe::GPU:
 #ifndef CPU_ONLY
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (this->IsFrozen(param_id)) { continue; }
       // save history momentum for stepping back
       caffe_copy(net_params[param_id]->count(),
           this->history_[param_id]->gpu_data(),
@@ -714,6 +738,7 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   switch (Caffe::mode()) {
   case Caffe::CPU:
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (this->IsFrozen(param_id)) { continue; }
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
 
@@ -770,6 +795,7 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue() {
   case Caffe::GPU:
 #ifndef CPU_ONLY
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+      if (this->IsFrozen(param_id)) { continue; }
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
 
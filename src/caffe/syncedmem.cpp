@@ -1,4 +1,11 @@
+#include <sys/mman.h>
+
+#include <algorithm>
 #include <cstring>
+#include <map>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
 
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -6,6 +13,157 @@
 
 namespace caffe {
 
+namespace {
+
+// Freed host buffers by size class, leaked on purpose so that blobs freed by
+// static destructors still find it.
+struct HostPool {
+  HostPool() : huge_pages(false), limit(kCaffeHostPoolLimit) {}
+  boost::mutex mutex;
+  std::map<size_t, std::vector<void*> > free_blocks;
+  HostMemoryStats stats;
+  bool huge_pages;
+  size_t limit;
+};
+
+HostPool& GetHostPool() {
+  static HostPool* pool = new HostPool();
+  return *pool;
+}
+
+const size_t kHugePageSize = 2 << 20;
+
+// Rounds size up to one of four classes per power of two, so that a reshaped
+// blob usually fits in a buffer freed by an earlier one of similar size while
+// wasting at most a quarter of it.
+size_t HostSizeClass(size_t size) {
+  size_t lower = kCaffeHostAlignment;
+  while (2 * lower < size) {
+    lower *= 2;
+  }
+  const size_t step = std::max(lower / 4, kCaffeHostAlignment);
+  return std::max((size + step - 1) / step * step, kCaffeHostAlignment);
+}
+
+}  // namespace
+
+// Each block starts with a header of kCaffeHostAlignment bytes holding its
+// size class, followed by the buffer handed out.
+void CaffeMallocHost(void** ptr, size_t size) {
+  const size_t size_class = HostSizeClass(size);
+  HostPool& pool = GetHostPool();
+  void* block = NULL;
+  bool huge_pages;
+  {
+    boost::mutex::scoped_lock lock(pool.mutex);
+    pool.stats.bytes_in_use += size_class;
+    std::vector<void*>& free_blocks = pool.free_blocks[size_class];
+    if (free_blocks.size()) {
+      block = free_blocks.back();
+      free_blocks.pop_back();
+      pool.stats.bytes_pooled -= size_class;
+      ++pool.stats.pool_allocs;
+    } else {
+      ++pool.stats.system_allocs;
+    }
+    huge_pages = pool.huge_pages;
+  }
+  if (!block) {
+    const size_t block_size = size_class + kCaffeHostAlignment;
+    const bool use_huge_pages = huge_pages && block_size >= kHugePageSize;
+    const int error = posix_memalign(&block,
+        use_huge_pages ? kHugePageSize : kCaffeHostAlignment, block_size);
+    CHECK_EQ(error, 0) << "Failed to allocate " << size << " bytes";
+#ifdef MADV_HUGEPAGE
+    if (use_huge_pages) {
+      // Only a hint; the kernel may not have transparent huge pages.
+      madvise(block, block_size, MADV_HUGEPAGE);
+    }
+#endif
+    *static_cast<size_t*>(block) = size_class;
+  }
+  *ptr = static_cast<char*>(block) + kCaffeHostAlignment;
+}
+
+void CaffeFreeHost(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  void* block = static_cast<char*>(ptr) - kCaffeHostAlignment;
+  const size_t size_class = *static_cast<size_t*>(block);
+  HostPool& pool = GetHostPool();
+  {
+    boost::mutex::scoped_lock lock(pool.mutex);
+    pool.stats.bytes_in_use -= size_class;
+    if (pool.stats.bytes_pooled + size_class <= pool.limit) {
+      pool.free_blocks[size_class].push_back(block);
+      pool.stats.bytes_pooled += size_class;
+      return;
+    }
+  }
+  // The pool is full, e.g. of one-off buffers that are never asked for again.
+  free(block);
+}
+
+HostMemoryStats CaffeHostMemoryStats() {
+  HostPool& pool = GetHostPool();
+  boost::mutex::scoped_lock lock(pool.mutex);
+  return pool.stats;
+}
+
+void CaffeSetHostHugePages(bool enabled) {
+  HostPool& pool = GetHostPool();
+  boost::mutex::scoped_lock lock(pool.mutex);
+  pool.huge_pages = enabled;
+}
+
+void CaffeSetHostPoolLimit(size_t bytes) {
+  HostPool& pool = GetHostPool();
+  boost::mutex::scoped_lock lock(pool.mutex);
+  pool.limit = bytes;
+  // Give back the largest buffers first.
+  while (pool.stats.bytes_pooled > pool.limit) {
+    std::map<size_t, std::vector<void*> >::iterator it =
+        --pool.free_blocks.end();
+    if (it->second.empty()) {
+      pool.free_blocks.erase(it);
+      continue;
+    }
+    free(it->second.back());
+    it->second.pop_back();
+    pool.stats.bytes_pooled -= it->first;
+  }
+}
+
+void CaffeReleaseHostPool() {
+  HostPool& pool = GetHostPool();
+  boost::mutex::scoped_lock lock(pool.mutex);
+  for (std::map<size_t, std::vector<void*> >::iterator it =
+       pool.free_blocks.begin(); it != pool.free_blocks.end(); ++it) {
+    for (int i = 0; i < it->second.size(); ++i) {
+      free(it->second[i]);
+    }
+  }
+  pool.free_blocks.clear();
+  pool.stats.bytes_pooled = 0;
+}
+
+const void* CaffeZerosHost(size_t size) {
+  static boost::mutex mutex;
+  // Earlier, smaller buffers may still be read, so they are never freed.
+  static std::vector<void*> buffers;
+  static size_t buffer_size = 0;
+  boost::mutex::scoped_lock lock(mutex);
+  if (size > buffer_size) {
+    buffer_size = std::max(size, 2 * buffer_size);
+    // calloc maps large buffers to zero pages, which take no memory as long
+    // as they are only read.
+    buffers.push_back(calloc(buffer_size, 1));
+    CHECK(buffers.back()) << "Failed to allocate " << buffer_size << " bytes";
+  }
+  return buffers.empty() ? NULL : buffers.back();
+}
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
     CaffeFreeHost(cpu_ptr_);
@@ -5,6 +5,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -54,4 +56,24 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestLazyDiff) {
+  Blob<TypeParam>* blob = this->blob_preshaped_;
+  caffe_set(blob->count(), TypeParam(1), blob->mutable_cpu_data());
+  // Reading or applying a diff nobody wrote allocates nothing.
+  const TypeParam* diff = blob->cpu_diff();
+  for (int i = 0; i < blob->count(); ++i) {
+    EXPECT_EQ(0, diff[i]);
+  }
+  blob->Update();
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED, blob->diff()->head());
+  EXPECT_EQ(1, blob->cpu_data()[0]);
+  blob->mutable_cpu_diff()[0] = 1;
+  EXPECT_EQ(SyncedMemory::HEAD_AT_CPU, blob->diff()->head());
+  EXPECT_EQ(1, blob->cpu_diff()[0]);
+  EXPECT_EQ(0, blob->cpu_diff()[1]);
+  blob->Update();
+  EXPECT_EQ(0, blob->cpu_data()[0]);
+  EXPECT_EQ(1, blob->cpu_data()[1]);
+}
+
 }  // namespace caffe
@@ -149,6 +149,25 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestNumRecords() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(3);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      EXPECT_EQ(5, layer.NumRecords());
+      // Counting keeps the prefetched batch.
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ((iter * 3 + i) % 5, blob_top_label_->cpu_data()[i]);
+      }
+    }
+  }
+
   void TestReadCrop() {
     const Dtype scale = 3;
     LayerParameter param;
@@ -331,6 +350,11 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestNumRecordsLevelDB) {
+  this->FillLevelDB(false);
+  this->TestNumRecords();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLevelDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -369,6 +393,11 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestNumRecordsLMDB) {
+  this->FillLMDB(false);
+  this->TestNumRecords();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
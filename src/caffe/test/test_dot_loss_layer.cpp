@@ -0,0 +1,117 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class DotLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  DotLossLayerTest()
+      : blob_bottom_a_(new Blob<Dtype>(10, 7, 1, 1)),
+        blob_bottom_b_(new Blob<Dtype>(10, 7, 1, 1)),
+        blob_bottom_loss_a_(new Blob<Dtype>(10, 1, 1, 1)),
+        blob_bottom_loss_b_(new Blob<Dtype>(10, 1, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_a_);
+    filler.Fill(this->blob_bottom_b_);
+    filler.Fill(this->blob_bottom_loss_a_);
+    filler.Fill(this->blob_bottom_loss_b_);
+    blob_bottom_vec_.push_back(blob_bottom_a_);
+    blob_bottom_vec_.push_back(blob_bottom_b_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~DotLossLayerTest() {
+    delete blob_bottom_a_;
+    delete blob_bottom_b_;
+    delete blob_bottom_loss_a_;
+    delete blob_bottom_loss_b_;
+    delete blob_top_loss_;
+  }
+
+  Blob<Dtype>* const blob_bottom_a_;
+  Blob<Dtype>* const blob_bottom_b_;
+  Blob<Dtype>* const blob_bottom_loss_a_;
+  Blob<Dtype>* const blob_bottom_loss_b_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DotLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(DotLossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  DotLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const int num = this->blob_bottom_a_->num();
+  const int dim = this->blob_bottom_a_->channels();
+  const Dtype* a = this->blob_bottom_a_->cpu_data();
+  const Dtype* b = this->blob_bottom_b_->cpu_data();
+  Dtype loss = 0;
+  for (int i = 0; i < num; ++i) {
+    Dtype aa = 0, bb = 0, ab = 0;
+    for (int j = 0; j < dim; ++j) {
+      aa += a[i * dim + j] * a[i * dim + j];
+      bb += b[i * dim + j] * b[i * dim + j];
+      ab += a[i * dim + j] * b[i * dim + j];
+    }
+    loss += 1 - ab / sqrt(aa * bb);
+  }
+  EXPECT_NEAR(loss / num, this->blob_top_loss_->cpu_data()[0], 1e-5);
+}
+
+TYPED_TEST(DotLossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.add_loss_weight(2.5);
+  DotLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(DotLossLayerTest, TestGatedBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_loss_a_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_loss_b_);
+  LayerParameter layer_param;
+  DotLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  this->blob_top_loss_->mutable_cpu_diff()[0] = 1;
+  vector<bool> propagate_down(4, false);
+  propagate_down[0] = propagate_down[1] = true;
+  layer.Backward(this->blob_top_vec_, propagate_down, &this->blob_bottom_vec_);
+  // Only the side with the larger loss of each pair gets a gradient.
+  const int dim = this->blob_bottom_a_->channels();
+  for (int i = 0; i < this->blob_bottom_a_->num(); ++i) {
+    const bool a_worse = this->blob_bottom_loss_a_->cpu_data()[i] >
+        this->blob_bottom_loss_b_->cpu_data()[i];
+    Dtype a_diff = 0, b_diff = 0;
+    for (int j = 0; j < dim; ++j) {
+      a_diff += fabs(this->blob_bottom_a_->cpu_diff()[i * dim + j]);
+      b_diff += fabs(this->blob_bottom_b_->cpu_diff()[i * dim + j]);
+    }
+    EXPECT_EQ(a_worse, a_diff > 0);
+    EXPECT_EQ(!a_worse, b_diff > 0);
+  }
+}
+
+}  // namespace caffe
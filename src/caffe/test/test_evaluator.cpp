@@ -0,0 +1,99 @@
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/evaluator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace evaluator {
+
+class SearcherTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // Four points, multi-labels padded with -1:
+    // p0 {0}, p1 {0}, p2 {1}, p3 {0, 1}.
+    const float label[] = { 0, -1, -1,
+                            0, -1, -1,
+                            1, -1, -1,
+                            0, 1, -1 };
+    label_.assign(label, label + 12);
+    // Unit vectors; p1 and p3 lie between p0 and p2.
+    const float points[] = { 1, 0,
+                             0.6, 0.8,
+                             0, 1,
+                             0.8, 0.6 };
+    points_.assign(points, points + 8);
+    searcher_.SetupGroundTruth(2, 4, 3, &label_[0]);
+    // Fix the (otherwise random) queries to p0 and p2.
+    searcher_.query_id_[0] = 0;
+    searcher_.query_id_[1] = 2;
+    delete[] searcher_.gndmat_;
+    delete[] searcher_.num_relevant_;
+    searcher_.gndmat_ = searcher_.CreateGroundTruthMatrix(
+        searcher_.query_id_, &label_[0], 4, 3);
+    searcher_.num_relevant_ = searcher_.SumRow(searcher_.gndmat_, 2, 4);
+  }
+
+  // Friendship is not inherited by the TEST_F bodies.
+  const float* gndmat() { return searcher_.gndmat_; }
+  const float* num_relevant() { return searcher_.num_relevant_; }
+
+  Searcher<float> searcher_;
+  std::vector<float> label_;
+  std::vector<float> points_;
+};
+
+TEST_F(SearcherTest, TestGroundTruth) {
+  const float expected[] = { 1, 1, 0, 1,
+                             0, 0, 1, 1 };
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(expected[i], gndmat()[i]);
+  }
+  EXPECT_EQ(3, num_relevant()[0]);
+  EXPECT_EQ(2, num_relevant()[1]);
+}
+
+TEST_F(SearcherTest, TestMAP) {
+  searcher_.Search(&points_[0], 2);
+  // Query p0 ranks p0, p3, p1, p2: AP 1. Query p2 ranks p2, p1, p3, p0:
+  // AP (1 + 2/3) / 2.
+  EXPECT_NEAR((1 + 5. / 6) / 2, searcher_.GetMAP(NULL), 1e-5);
+  EXPECT_NEAR(1., searcher_.GetMAP(NULL, 1), 1e-5);
+}
+
+TEST_F(SearcherTest, TestPrecision) {
+  searcher_.Search(&points_[0], 2);
+  EXPECT_NEAR(1., searcher_.GetPrecision(NULL, 1), 1e-5);
+  EXPECT_NEAR((1 + 0.5) / 2, searcher_.GetPrecision(NULL, 2), 1e-5);
+}
+
+TEST_F(SearcherTest, TestPrecisionRecall) {
+  searcher_.Search(&points_[0], 2);
+  std::vector<std::pair<float, float> > curve =
+      searcher_.GetPrecisionRecall(3);
+  ASSERT_EQ(3, curve.size());
+  EXPECT_NEAR(0., curve[0].second, 1e-5);
+  EXPECT_NEAR(0.5, curve[1].second, 1e-5);
+  EXPECT_NEAR(1., curve[2].second, 1e-5);
+  EXPECT_NEAR(1., curve[0].first, 1e-5);
+  EXPECT_NEAR(1., curve[1].first, 1e-5);
+  EXPECT_NEAR((1 + 2. / 3) / 2, curve[2].first, 1e-5);
+}
+
+TEST_F(SearcherTest, TestCrossModalSearch) {
+  // Queries taken from a rotated copy: p0 -> p2's direction and back.
+  std::vector<float> rotated(8);
+  for (int i = 0; i < 4; ++i) {
+    rotated[2 * i] = points_[2 * i + 1];
+    rotated[2 * i + 1] = points_[2 * i];
+  }
+  const float* sim = searcher_.Search(&rotated[0], &points_[0], 2);
+  // The p0 query now points along p2, the p2 query along p0.
+  EXPECT_NEAR(1., sim[2], 1e-5);
+  EXPECT_NEAR(1., sim[4], 1e-5);
+}
+
+}  // namespace evaluator
@@ -0,0 +1,82 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/feature_io.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FeatureIOTest : public ::testing::Test {
+ protected:
+  FeatureIOTest() : num_(5), dim_(7) {}
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    for (int i = 0; i < num_ * dim_; ++i) {
+      features_.push_back((i % 11) * 0.25 - 1.);
+    }
+  }
+  virtual void TearDown() { remove(filename_.c_str()); }
+
+  const int num_;
+  const int dim_;
+  string filename_;
+  vector<float> features_;
+};
+
+TEST_F(FeatureIOTest, TestHalfConversion) {
+  const float exact[] = { 0., -0., 1., -2.5, 0.099975586, 65504., 6.1035156e-05,
+      5.9604645e-08 };
+  for (int i = 0; i < sizeof(exact) / sizeof(exact[0]); ++i) {
+    EXPECT_EQ(exact[i], HalfToFloat(FloatToHalf(exact[i])));
+  }
+  EXPECT_EQ(0x3c00, FloatToHalf(1.));
+  EXPECT_EQ(0xc000, FloatToHalf(-2.));
+  EXPECT_EQ(0x7c00, FloatToHalf(1e6));
+  // 1 + 2^-11 is halfway between 1 and the next half; ties go to even.
+  EXPECT_EQ(0x3c00, FloatToHalf(1. + 1. / 2048));
+  EXPECT_EQ(0x3c01, FloatToHalf(1. + 3. / 4096));
+}
+
+TEST_F(FeatureIOTest, TestWriteReadFloat) {
+  {
+    FeatureFileWriter writer(filename_, dim_);
+    // Stream the rows in two chunks.
+    writer.Write(&features_[0], 2);
+    writer.Write(&features_[2 * dim_], num_ - 2);
+    EXPECT_EQ(num_, writer.num());
+  }
+  MappedFeatureFile mapped(filename_);
+  EXPECT_EQ(num_, mapped.num());
+  EXPECT_EQ(dim_, mapped.dim());
+  EXPECT_EQ(FEATURE_FLOAT32, mapped.type());
+  const float* data = mapped.data();
+  EXPECT_EQ(0, (reinterpret_cast<const char*>(data) -
+      static_cast<const char*>(mapped.raw_data())));
+  for (int i = 0; i < num_ * dim_; ++i) {
+    EXPECT_EQ(features_[i], data[i]);
+  }
+}
+
+TEST_F(FeatureIOTest, TestWriteReadHalfFromDouble) {
+  vector<double> features(features_.begin(), features_.end());
+  FeatureFileWriter writer(filename_, dim_, FEATURE_FLOAT16);
+  writer.Write(&features[0], num_);
+  writer.Close();
+  MappedFeatureFile mapped(filename_);
+  EXPECT_EQ(num_, mapped.num());
+  EXPECT_EQ(dim_, mapped.dim());
+  EXPECT_EQ(FEATURE_FLOAT16, mapped.type());
+  const float* data = mapped.data();
+  for (int i = 0; i < num_ * dim_; ++i) {
+    // Multiples of 1/4 are exact in half precision.
+    EXPECT_EQ(features_[i], data[i]);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,223 @@
+#include <string>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FuseLayersTest : public ::testing::Test {
+ protected:
+  void RunFusionTest(
+      const string& input_param_string, const string& output_param_string) {
+    // Test that FuseLayers called on the proto specified by
+    // input_param_string results in the proto specified by
+    // output_param_string.
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    FuseLayers(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_fused_param;
+    FuseLayers(actual_output_param, &double_fused_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+        double_fused_param.DebugString());
+  }
+};
+
+TEST_F(FuseLayersTest, TestFuseInPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'conv1' "
+      "  top: 'fc1' "
+      "} "
+      "layers: { "
+      "  name: 'drop1' "
+      "  type: DROPOUT "
+      "  bottom: 'fc1' "
+      "  top: 'fc1' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'fc1' "
+      "  top: 'fc1' "
+      "  relu_param { "
+      "    negative_slope: 0.5 "
+      "  } "
+      "} "
+      "layers: { "
+      "  name: 'fc2' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'fc1' "
+      "  top: 'fc2' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  relu_param { "
+      "  } "
+      "} "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'conv1' "
+      "  top: 'fc1' "
+      "  relu_param { "
+      "    negative_slope: 0.5 "
+      "  } "
+      "} "
+      "layers: { "
+      "  name: 'fc2' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'fc1' "
+      "  top: 'fc2' "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseLayersTest, TestFuseOutOfPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'data' "
+      "  top: 'fc1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'fc1' "
+      "  top: 'relu1' "
+      "} "
+      "layers: { "
+      "  name: 'drop1' "
+      "  type: DROPOUT "
+      "  bottom: 'relu1' "
+      "  top: 'drop1' "
+      "} "
+      "layers: { "
+      "  name: 'fc2' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'drop1' "
+      "  top: 'fc2' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'data' "
+      "  top: 'relu1' "
+      "  relu_param { "
+      "  } "
+      "} "
+      "layers: { "
+      "  name: 'fc2' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'relu1' "
+      "  top: 'fc2' "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseLayersTest, TestNoFusion) {
+  // relu1 would change what pool1 reads, relu2 does not follow a CONVOLUTION
+  // or INNER_PRODUCT, relu3 would hide fc1 from fc2 and drop1 would hide
+  // pool1 from fc3.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "input: 'data' "
+      "layers: { "
+      "  name: 'conv1' "
+      "  type: CONVOLUTION "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'pool1' "
+      "  type: POOLING "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "} "
+      "layers: { "
+      "  name: 'relu1' "
+      "  type: RELU "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layers: { "
+      "  name: 'relu2' "
+      "  type: RELU "
+      "  bottom: 'pool1' "
+      "  top: 'pool1' "
+      "} "
+      "layers: { "
+      "  name: 'fc1' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'pool1' "
+      "  top: 'fc1' "
+      "} "
+      "layers: { "
+      "  name: 'relu3' "
+      "  type: RELU "
+      "  bottom: 'fc1' "
+      "  top: 'relu3' "
+      "} "
+      "layers: { "
+      "  name: 'fc2' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'fc1' "
+      "  top: 'fc2' "
+      "} "
+      "layers: { "
+      "  name: 'drop1' "
+      "  type: DROPOUT "
+      "  bottom: 'pool1' "
+      "  top: 'drop1' "
+      "} "
+      "layers: { "
+      "  name: 'fc3' "
+      "  type: INNER_PRODUCT "
+      "  bottom: 'drop1' "
+      "  top: 'fc3' "
+      "} ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+}  // namespace caffe
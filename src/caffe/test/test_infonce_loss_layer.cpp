@@ -0,0 +1,122 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class InfoNCELossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  InfoNCELossLayerTest()
+      : blob_bottom_a_(new Blob<Dtype>(6, 5, 1, 1)),
+        blob_bottom_b_(new Blob<Dtype>(6, 5, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_a_);
+    filler.Fill(this->blob_bottom_b_);
+    blob_bottom_vec_.push_back(blob_bottom_a_);
+    blob_bottom_vec_.push_back(blob_bottom_b_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~InfoNCELossLayerTest() {
+    delete blob_bottom_a_;
+    delete blob_bottom_b_;
+    delete blob_top_loss_;
+  }
+
+  // Brute-force loss, one similarity at a time.
+  Dtype ReferenceLoss(const Dtype temperature, const bool normalize) {
+    const int num = blob_bottom_a_->num();
+    const int dim = blob_bottom_a_->channels();
+    const Dtype* a = blob_bottom_a_->cpu_data();
+    const Dtype* b = blob_bottom_b_->cpu_data();
+    vector<Dtype> sim(num * num);
+    for (int i = 0; i < num; ++i) {
+      for (int j = 0; j < num; ++j) {
+        Dtype aa = 0, bb = 0, ab = 0;
+        for (int k = 0; k < dim; ++k) {
+          aa += a[i * dim + k] * a[i * dim + k];
+          bb += b[j * dim + k] * b[j * dim + k];
+          ab += a[i * dim + k] * b[j * dim + k];
+        }
+        sim[i * num + j] = (normalize ? ab / sqrt(aa * bb) : ab) / temperature;
+      }
+    }
+    Dtype loss = 0;
+    for (int i = 0; i < num; ++i) {
+      Dtype row_sum = 0, col_sum = 0;
+      for (int j = 0; j < num; ++j) {
+        row_sum += exp(sim[i * num + j]);
+        col_sum += exp(sim[j * num + i]);
+      }
+      loss += log(row_sum) + log(col_sum) - 2 * sim[i * num + i];
+    }
+    return loss / (2 * num);
+  }
+
+  Blob<Dtype>* const blob_bottom_a_;
+  Blob<Dtype>* const blob_bottom_b_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(InfoNCELossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(InfoNCELossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InfoNCELossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_NEAR(this->ReferenceLoss(0.1, true),
+      this->blob_top_loss_->cpu_data()[0], 1e-4);
+}
+
+TYPED_TEST(InfoNCELossLayerTest, TestForwardUnnormalized) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_infonce_param()->set_temperature(2.);
+  layer_param.mutable_infonce_param()->set_normalize(false);
+  InfoNCELossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_NEAR(this->ReferenceLoss(2., false),
+      this->blob_top_loss_->cpu_data()[0], 1e-4);
+}
+
+TYPED_TEST(InfoNCELossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.add_loss_weight(2.5);
+  layer_param.mutable_infonce_param()->set_temperature(0.5);
+  InfoNCELossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(InfoNCELossLayerTest, TestGradientUnnormalized) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_infonce_param()->set_temperature(2.);
+  layer_param.mutable_infonce_param()->set_normalize(false);
+  InfoNCELossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+}  // namespace caffe
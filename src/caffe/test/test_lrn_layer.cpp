@@ -159,6 +159,43 @@ TYPED_TEST(LRNLayerTest, TestGradientAcrossChannels) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(LRNLayerTest, TestForwardAcrossChannelsLargeImage) {
+  // More pixels than the CPU implementation processes at once, and a beta
+  // off its fast path.
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 10, 17, 17);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_beta(0.5);
+  LRNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<Dtype> top_reference;
+  this->ReferenceLRNForward(*(this->blob_bottom_), layer_param,
+      &top_reference);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], top_reference.cpu_data()[i],
+                this->epsilon_);
+  }
+}
+
+TYPED_TEST(LRNLayerTest, TestGradientAcrossChannelsLargeImage) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(1, 6, 17, 17);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_lrn_param()->set_local_size(3);
+  layer_param.mutable_lrn_param()->set_beta(0.5);
+  LRNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradient(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
 TYPED_TEST(LRNLayerTest, TestSetupWithinChannel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
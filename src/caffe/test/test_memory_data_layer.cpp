@@ -164,4 +164,53 @@ TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   }
 }
 
+TYPED_TEST(MemoryDataLayerTest, AddDatumVectorPerChannelMean) {
+  typedef typename TypeParam::Dtype Dtype;
+
+  LayerParameter param;
+  MemoryDataParameter* memory_data_param = param.mutable_memory_data_param();
+  memory_data_param->set_batch_size(this->batch_size_);
+  memory_data_param->set_channels(this->channels_);
+  memory_data_param->set_height(this->height_);
+  memory_data_param->set_width(this->width_);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_scale(0.5);
+  for (int c = 0; c < this->channels_; ++c) {
+    transform_param->add_mean_value(10 * c);
+  }
+  MemoryDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+
+  vector<Datum> datum_vector(this->batch_size_);
+  const size_t count = this->channels_ * this->height_ * this->width_;
+  size_t pixel_index = 0;
+  for (int i = 0; i < this->batch_size_; ++i) {
+    datum_vector[i].set_channels(this->channels_);
+    datum_vector[i].set_height(this->height_);
+    datum_vector[i].set_width(this->width_);
+    datum_vector[i].set_label(i);
+    vector<char> pixels(count);
+    for (int j = 0; j < count; ++j) {
+      pixels[j] = pixel_index++ % 256;
+    }
+    datum_vector[i].set_data(&(pixels[0]), count);
+  }
+
+  layer.AddDatumVector(datum_vector);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const Dtype* data = this->data_blob_->cpu_data();
+  size_t index = 0;
+  for (int i = 0; i < this->batch_size_; ++i) {
+    const string& data_string = datum_vector[i].data();
+    for (int c = 0; c < this->channels_; ++c) {
+      for (int j = 0; j < this->height_ * this->width_; ++j) {
+        const int data_index = c * this->height_ * this->width_ + j;
+        const Dtype pixel = static_cast<Dtype>(
+            static_cast<uint8_t>(data_string[data_index]));
+        EXPECT_EQ((pixel - 10 * c) * Dtype(0.5), data[index++]);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
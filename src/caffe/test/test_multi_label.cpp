@@ -0,0 +1,62 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/multi_label.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MultiLabelTest : public ::testing::Test {};
+
+TEST_F(MultiLabelTest, TestFromBlob) {
+  // The last row uses every slot, so it has no -1 terminator.
+  const float label[] = { 3, 1, -1,
+                          0, -1, -1,
+                          5, 2, 4 };
+  Blob<float> blob(3, 3, 1, 1);
+  caffe_copy(9, label, blob.mutable_cpu_data());
+  MultiLabel labels;
+  labels.FromBlob(blob);
+  EXPECT_EQ(3, labels.num());
+  EXPECT_EQ(6, labels.nnz());
+  EXPECT_EQ(6, labels.num_classes());
+  EXPECT_TRUE(labels.has_mask());
+  const int offsets[] = { 0, 2, 3, 6 };
+  const int ids[] = { 1, 3, 0, 2, 4, 5 };
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(offsets[i], labels.offsets()[i]);
+  }
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(ids[i], labels.ids()[i]);
+  }
+  EXPECT_EQ(3, labels.size(2));
+  EXPECT_EQ(2, labels.labels(2)[0]);
+  EXPECT_EQ(uint64_t(0xa), labels.mask(0)[0]);
+  EXPECT_EQ(uint64_t(0), labels.mask(0)[1]);
+}
+
+TEST_F(MultiLabelTest, TestContainsShares) {
+  // Label 130 does not fit the mask; both paths must agree.
+  for (int large = 0; large < 2; ++large) {
+    const double label[] = { 1, 70, -1,
+                              70, 2, -1,
+                              3, large ? 130 : 4, -1 };
+    MultiLabel labels;
+    labels.FromPadded(label, 3, 3);
+    EXPECT_EQ(!large, labels.has_mask());
+    EXPECT_TRUE(labels.Contains(0, 70));
+    EXPECT_FALSE(labels.Contains(0, 2));
+    EXPECT_FALSE(labels.Contains(0, 200));
+    EXPECT_EQ(large, labels.Contains(2, 130));
+    EXPECT_TRUE(labels.Shares(0, 1));
+    EXPECT_TRUE(labels.Shares(2, 2));
+    EXPECT_FALSE(labels.Shares(0, 2));
+    EXPECT_FALSE(labels.Shares(1, 2));
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -5,10 +6,14 @@
 #include "google/protobuf/text_format.h"
 
 #include "gtest/gtest.h"
+#include "leveldb/db.h"
 
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -596,6 +601,449 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitFusableNet(const bool fuse_layers) {
+    string proto =
+        "name: 'FusableNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 6 "
+        "input_dim: 5 "
+        "layers: { "
+        "  name: 'conv1' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'conv1' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "    bias_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu2' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "  relu_param { "
+        "    negative_slope: 0.1 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'drop1' "
+        "  type: DROPOUT "
+        "  bottom: 'ip1' "
+        "  top: 'drop1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'drop1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} ";
+    if (fuse_layers) {
+      proto += "fuse_layers: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitChainNet(const bool share_activations) {
+    string proto =
+        "name: 'ChainNetwork' "
+        "input: 'data' "
+        "input_dim: 4 "
+        "input_dim: 6 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'relu1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'relu1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu2' "
+        "  type: RELU "
+        "  bottom: 'ip2' "
+        "  top: 'relu2' "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'relu2' "
+        "  top: 'ip3' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "keep_blob: 'ip2' ";
+    if (share_activations) {
+      proto += "share_activations: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  // relu1 feeds both ip2 and the concat, through a split layer, and the
+  // concat is flattened; split and flatten tops only point at their bottom
+  // once Forward runs.
+  virtual void InitBranchNet(const bool share_activations) {
+    string proto =
+        "name: 'BranchNetwork' "
+        "input: 'data' "
+        "input_dim: 4 "
+        "input_dim: 6 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'relu1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'relu1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'concat' "
+        "  type: CONCAT "
+        "  bottom: 'relu1' "
+        "  bottom: 'ip3' "
+        "  top: 'concat' "
+        "} "
+        "layers: { "
+        "  name: 'flat' "
+        "  type: FLATTEN "
+        "  bottom: 'concat' "
+        "  top: 'flat' "
+        "} "
+        "layers: { "
+        "  name: 'ip4' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'flat' "
+        "  top: 'ip4' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip5' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip4' "
+        "  top: 'ip5' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} ";
+    if (share_activations) {
+      proto += "share_activations: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitTwoTowerNet(const int num_threads) {
+    ostringstream proto;
+    proto <<
+        "name: 'TwoTowerNetwork' "
+        "input: 'image' "
+        "input_dim: 5 "
+        "input_dim: 6 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "input: 'text' "
+        "input_dim: 5 "
+        "input_dim: 4 "
+        "input_dim: 1 "
+        "input_dim: 1 "
+        "layers: { "
+        "  name: 'image1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'image' "
+        "  top: 'image1' "
+        "  inner_product_param { "
+        "    num_output: 7 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'image_relu1' "
+        "  type: RELU "
+        "  bottom: 'image1' "
+        "  top: 'image1' "
+        "} "
+        "layers: { "
+        "  name: 'image_drop1' "
+        "  type: DROPOUT "
+        "  bottom: 'image1' "
+        "  top: 'image1' "
+        "} "
+        "layers: { "
+        "  name: 'image2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'image1' "
+        "  top: 'image2' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'text1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'text' "
+        "  top: 'text1' "
+        "  inner_product_param { "
+        "    num_output: 7 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'text_relu1' "
+        "  type: RELU "
+        "  bottom: 'text1' "
+        "  top: 'text1' "
+        "} "
+        "layers: { "
+        "  name: 'text_drop1' "
+        "  type: DROPOUT "
+        "  bottom: 'text1' "
+        "  top: 'text1' "
+        "} "
+        "layers: { "
+        "  name: 'text2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'text1' "
+        "  top: 'text2' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: EUCLIDEAN_LOSS "
+        "  bottom: 'image2' "
+        "  bottom: 'text2' "
+        "} "
+        "num_threads: " << num_threads;
+    InitNetFromProtoString(proto.str());
+  }
+
+  // Fill a leveldb with 5 records of distinct images, labelled 0 to 4.
+  virtual void FillLevelDB(const string& filename) {
+    leveldb::DB* db;
+    leveldb::Options options;
+    options.error_if_exists = true;
+    options.create_if_missing = true;
+    CHECK(leveldb::DB::Open(options, filename, &db).ok());
+    for (int i = 0; i < 5; ++i) {
+      Datum datum;
+      datum.set_label(i);
+      datum.set_channels(2);
+      datum.set_height(1);
+      datum.set_width(3);
+      for (int j = 0; j < 6; ++j) {
+        datum.mutable_data()->push_back(static_cast<uint8_t>(i * 7 + j));
+      }
+      ostringstream key;
+      key << i;
+      db->Put(leveldb::WriteOptions(), key.str(), datum.SerializeAsString());
+    }
+    delete db;
+  }
+
+  virtual string FrozenTowerProto(const string& source, const bool cache,
+      const string& cache_source = "") {
+    ostringstream proto;
+    proto <<
+        "name: 'FrozenTowerNetwork' "
+        "layers: { "
+        "  name: 'data' "
+        "  type: DATA "
+        "  top: 'data' "
+        "  top: 'label' "
+        "  data_param { "
+        "    source: '" << source << "' "
+        "    batch_size: 2 "
+        "  } "
+        "  transform_param { "
+        "    scale: 0.05 "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  blobs_lr: 0 "
+        "  blobs_lr: 0 "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'relu1' "
+        "  type: RELU "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'loss' "
+        "  type: SOFTMAX_LOSS "
+        "  bottom: 'ip2' "
+        "  bottom: 'label' "
+        "} ";
+    if (cache) {
+      proto << "feature_cache { layer: 'relu1' source: '" << cache_source
+            << "' } ";
+    }
+    return proto.str();
+  }
+
+  virtual void InitFrozenTowerNet(const string& source, const bool cache,
+      const string& cache_source = "") {
+    InitNetFromProtoString(FrozenTowerProto(source, cache, cache_source));
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -994,7 +1442,7 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   EXPECT_EQ(ip1_weights->cpu_data(), ip2_weights->cpu_data());
   // Check that diff blobs of shared weights are at different locations in
   // locations.  (The diffs should be accumulated at update time.)
-  EXPECT_NE(ip1_weights->cpu_diff(), ip2_weights->cpu_diff());
+  EXPECT_NE(ip1_weights->mutable_cpu_diff(), ip2_weights->mutable_cpu_diff());
   this->net_->Forward(bottom);
   this->net_->Backward();
   // Compute the expected update as the data minus the two diffs.
@@ -1033,7 +1481,7 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   // Check that data and diff blobs of unshared weights are at different
   // locations in memory.
   EXPECT_NE(ip1_weights->cpu_data(), ip2_weights->cpu_data());
-  EXPECT_NE(ip1_weights->cpu_diff(), ip2_weights->cpu_diff());
+  EXPECT_NE(ip1_weights->mutable_cpu_diff(), ip2_weights->mutable_cpu_diff());
   this->net_->Forward(bottom);
   this->net_->Backward();
   // Compute the expected update.
@@ -2149,4 +2597,305 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestFuseLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 6, 5);
+  filler.Fill(&data);
+  // The fused net must compute the same outputs with the same weights.
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_random_seed(this->seed_);
+  this->InitFusableNet(false);
+  EXPECT_EQ(6, this->net_->layers().size());
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> output;
+  output.CopyFrom(*this->net_->output_blobs()[0], false, true);
+  Caffe::set_random_seed(this->seed_);
+  this->InitFusableNet(true);
+  EXPECT_EQ(3, this->net_->layers().size());
+  EXPECT_FALSE(this->net_->has_layer("relu1"));
+  EXPECT_FALSE(this->net_->has_layer("drop1"));
+  EXPECT_FALSE(this->net_->has_blob("drop1"));
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  const Blob<Dtype>* fused_output = this->net_->output_blobs()[0];
+  ASSERT_EQ(output.count(), fused_output->count());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_NEAR(output.cpu_data()[i], fused_output->cpu_data()[i], 1e-4);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestShareActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(4, 6, 1, 1);
+  filler.Fill(&data);
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(false);
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> ip2, ip3;
+  ip2.CopyFrom(*this->net_->blob_by_name("ip2"), false, true);
+  ip3.CopyFrom(*this->net_->blob_by_name("ip3"), false, true);
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(true);
+  // ip1 is dead by the time relu2 is computed; ip2, kept, and the input and
+  // output of the net have memory of their own.
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->data(),
+      this->net_->blob_by_name("relu2")->data());
+  EXPECT_NE(this->net_->blob_by_name("ip1")->data(),
+      this->net_->blob_by_name("relu1")->data());
+  const char* kept[] = { "data", "ip2", "ip3" };
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < this->net_->blobs().size(); ++j) {
+      if (this->net_->blob_names()[j] != kept[i]) {
+        EXPECT_NE(this->net_->blob_by_name(kept[i])->data(),
+            this->net_->blobs()[j]->data());
+      }
+    }
+  }
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  const Dtype* shared_ip2 = this->net_->blob_by_name("ip2")->cpu_data();
+  for (int i = 0; i < ip2.count(); ++i) {
+    EXPECT_EQ(ip2.cpu_data()[i], shared_ip2[i]);
+  }
+  const Dtype* shared_ip3 = this->net_->blob_by_name("ip3")->cpu_data();
+  for (int i = 0; i < ip3.count(); ++i) {
+    EXPECT_EQ(ip3.cpu_data()[i], shared_ip3[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestShareActivationsSplitFlatten) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(4, 6, 1, 1);
+  filler.Fill(&data);
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchNet(false);
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> ip5;
+  ip5.CopyFrom(*this->net_->blob_by_name("ip5"), false, true);
+  Caffe::set_random_seed(this->seed_);
+  this->InitBranchNet(true);
+  // The split tops and the flattened concat are planned with their bottom.
+  const shared_ptr<Blob<Dtype> > relu1 = this->net_->blob_by_name("relu1");
+  for (int i = 0; i < this->net_->blobs().size(); ++i) {
+    if (this->net_->blob_names()[i].find("relu1_relu1_0_split") == 0) {
+      EXPECT_EQ(relu1->data(), this->net_->blobs()[i]->data());
+    }
+  }
+  EXPECT_EQ(this->net_->blob_by_name("concat")->data(),
+      this->net_->blob_by_name("flat")->data());
+  for (int iter = 0; iter < 2; ++iter) {
+    caffe_copy(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->mutable_cpu_data());
+    this->net_->ForwardPrefilled();
+    const Dtype* shared_ip5 = this->net_->blob_by_name("ip5")->cpu_data();
+    for (int i = 0; i < ip5.count(); ++i) {
+      EXPECT_EQ(ip5.cpu_data()[i], shared_ip5[i]);
+    }
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestConcurrentTowers) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> image(5, 6, 1, 1);
+  Blob<Dtype> text(5, 4, 1, 1);
+  filler.Fill(&image);
+  filler.Fill(&text);
+  // Running the towers concurrently must give exactly the results of running
+  // the layers in order, dropout included.
+  vector<shared_ptr<Blob<Dtype> > > params[2];
+  Dtype loss[2];
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitTwoTowerNet(run * 3);
+    caffe_copy(image.count(), image.cpu_data(),
+        this->net_->input_blobs()[0]->mutable_cpu_data());
+    caffe_copy(text.count(), text.cpu_data(),
+        this->net_->input_blobs()[1]->mutable_cpu_data());
+    Caffe::set_random_seed(this->seed_);
+    loss[run] = this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+    for (int i = 0; i < this->net_->params().size(); ++i) {
+      params[run].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      params[run][i]->CopyFrom(*this->net_->params()[i], false, true);
+      params[run][i]->CopyFrom(*this->net_->params()[i], true);
+    }
+  }
+  EXPECT_EQ(loss[0], loss[1]);
+  ASSERT_EQ(params[0].size(), params[1].size());
+  for (int i = 0; i < params[0].size(); ++i) {
+    for (int j = 0; j < params[0][i]->count(); ++j) {
+      EXPECT_EQ(params[0][i]->cpu_data()[j], params[1][i]->cpu_data()[j]);
+      EXPECT_EQ(params[0][i]->cpu_diff()[j], params[1][i]->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestFeatureCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  this->FillLevelDB(source);
+  string cache_source;
+  MakeTempDir(&cache_source);
+  cache_source += "/cache";
+  const int kNumIters = 8;
+  vector<Dtype> losses;
+  Caffe::set_random_seed(this->seed_);
+  this->InitFrozenTowerNet(source, false);
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    losses.push_back(this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+  }
+  // Batches of 2 of the 5 records are all cached from the fourth on, after
+  // which the frozen tower no longer runs: zeroing its weights must not
+  // change the results.
+  Caffe::set_random_seed(this->seed_);
+  this->InitFrozenTowerNet(source, true);
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    if (iter == 3) {
+      const vector<shared_ptr<Blob<Dtype> > >& ip1_blobs =
+          this->net_->layer_by_name("ip1")->blobs();
+      for (int i = 0; i < ip1_blobs.size(); ++i) {
+        caffe_set(ip1_blobs[i]->count(), Dtype(0),
+                  ip1_blobs[i]->mutable_cpu_data());
+      }
+    }
+    EXPECT_EQ(losses[iter],
+              this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+  }
+  // A cache kept in a leveldb serves a later net from its first batch.
+  Caffe::set_random_seed(this->seed_);
+  this->InitFrozenTowerNet(source, true, cache_source);
+  for (int iter = 0; iter < 3; ++iter) {
+    EXPECT_EQ(losses[iter],
+              this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+  }
+  this->net_.reset();
+  Caffe::set_random_seed(this->seed_);
+  this->InitFrozenTowerNet(source, true, cache_source);
+  const vector<shared_ptr<Blob<Dtype> > >& ip1_blobs =
+      this->net_->layer_by_name("ip1")->blobs();
+  for (int i = 0; i < ip1_blobs.size(); ++i) {
+    caffe_set(ip1_blobs[i]->count(), Dtype(0),
+              ip1_blobs[i]->mutable_cpu_data());
+  }
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    EXPECT_EQ(losses[iter],
+              this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+  }
+}
+
+TYPED_TEST(NetTest, TestFeatureCacheTrainOnly) {
+  typedef typename TypeParam::Dtype Dtype;
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  this->FillLevelDB(source);
+  string test_source;
+  MakeTempDir(&test_source);
+  test_source += "/db";
+  this->FillLevelDB(test_source);
+  string cache_source;
+  MakeTempDir(&cache_source);
+  cache_source += "/cache";
+  SolverParameter solver_param;
+  NetParameter* net_param = solver_param.mutable_net_param();
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      this->FrozenTowerProto(source, true, cache_source), net_param));
+  LayerParameter* data_param = net_param->mutable_layers(0);
+  data_param->add_include()->set_phase(TRAIN);
+  LayerParameter* test_data_param = net_param->add_layers();
+  test_data_param->CopyFrom(*data_param);
+  test_data_param->mutable_include(0)->set_phase(TEST);
+  test_data_param->mutable_data_param()->set_source(test_source);
+  // Move it ahead of the layers reading its tops.
+  for (int i = net_param->layers_size() - 1; i > 1; --i) {
+    net_param->mutable_layers()->SwapElements(i, i - 1);
+  }
+  solver_param.add_test_iter(1);
+  solver_param.add_test_interval(1);
+  solver_param.set_solver_mode(Caffe::mode() == Caffe::CPU ?
+      SolverParameter_SolverMode_CPU : SolverParameter_SolverMode_GPU);
+  // The test net, built from the same definition, must not open the cache.
+  SGDSolver<Dtype> solver(solver_param);
+  EXPECT_EQ(1, solver.net()->num_feature_caches());
+  ASSERT_EQ(1, solver.test_nets().size());
+  EXPECT_EQ(0, solver.test_nets()[0]->num_feature_caches());
+  // Unless a rule asks for it.
+  net_param->mutable_feature_cache(0)->add_include()->set_phase(TEST);
+  net_param->mutable_feature_cache(0)->clear_source();
+  net_param->mutable_state()->set_phase(TEST);
+  Net<Dtype> test_net(*net_param);
+  EXPECT_EQ(1, test_net.num_feature_caches());
+}
+
+TYPED_TEST(NetTest, TestLazyDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  this->FillLevelDB(source);
+  this->InitFrozenTowerNet(source, false);
+  this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  this->net_->Update();
+  // Only the blobs on the path of the gradient to ip2 get a diff.
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+            this->net_->blob_by_name("data")->diff()->head());
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+            this->net_->blob_by_name("label")->diff()->head());
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+            this->net_->blob_by_name("ip1")->diff()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+            this->net_->blob_by_name("ip2")->diff()->head());
+  const vector<shared_ptr<Blob<Dtype> > >& ip1_blobs =
+      this->net_->layer_by_name("ip1")->blobs();
+  for (int i = 0; i < ip1_blobs.size(); ++i) {
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED, ip1_blobs[i]->diff()->head());
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& ip2_blobs =
+      this->net_->layer_by_name("ip2")->blobs();
+  for (int i = 0; i < ip2_blobs.size(); ++i) {
+    EXPECT_NE(SyncedMemory::UNINITIALIZED, ip2_blobs[i]->diff()->head());
+  }
+}
+
+TYPED_TEST(NetTest, TestSteadyStateHostAllocs) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNet(true);
+  this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  const size_t system_allocs = this->net_->host_system_allocs();
+  const size_t pool_allocs = this->net_->host_pool_allocs();
+  EXPECT_GT(system_allocs + pool_allocs, 0);
+  // Once every blob has its memory, iterations allocate nothing.
+  for (int i = 0; i < 3; ++i) {
+    this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  }
+  EXPECT_EQ(system_allocs, this->net_->host_system_allocs());
+  EXPECT_EQ(pool_allocs, this->net_->host_pool_allocs());
+}
+
 }  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <vector>
 
@@ -6,6 +8,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -42,6 +45,56 @@ class PoolingLayerTest : public MultiDeviceTest<TypeParam> {
   Blob<Dtype>* const blob_top_mask_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
+  // Compares unpadded pooling of blob_bottom_ against a brute-force
+  // reference; windows past the image are empty, with no max and no argmax.
+  void TestForwardReference(const int kernel, const int stride,
+      const PoolingParameter_PoolMethod pool) {
+    const bool max = pool == PoolingParameter_PoolMethod_MAX;
+    // only max pooling outputs a mask
+    blob_top_vec_.resize(1);
+    if (max) {
+      blob_top_vec_.push_back(blob_top_mask_);
+    }
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(kernel);
+    pooling_param->set_stride(stride);
+    pooling_param->set_pool(pool);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    const Blob<Dtype>& bottom = *blob_bottom_;
+    const Blob<Dtype>& top = *blob_top_;
+    for (int n = 0; n < top.num(); ++n) {
+      for (int c = 0; c < top.channels(); ++c) {
+        for (int ph = 0; ph < top.height(); ++ph) {
+          for (int pw = 0; pw < top.width(); ++pw) {
+            const int hend = std::min(ph * stride + kernel, bottom.height());
+            const int wend = std::min(pw * stride + kernel, bottom.width());
+            Dtype maxval = -FLT_MAX, sum = 0;
+            int argmax = -1;
+            for (int h = ph * stride; h < hend; ++h) {
+              for (int w = pw * stride; w < wend; ++w) {
+                const Dtype value = bottom.data_at(n, c, h, w);
+                sum += value;
+                if (value > maxval) {
+                  maxval = value;
+                  argmax = h * bottom.width() + w;
+                }
+              }
+            }
+            if (max) {
+              EXPECT_EQ(maxval, top.data_at(n, c, ph, pw));
+              EXPECT_EQ(argmax, blob_top_mask_->data_at(n, c, ph, pw));
+            } else {
+              EXPECT_NEAR(sum / ((hend - ph * stride) * (wend - pw * stride)),
+                  top.data_at(n, c, ph, pw), 1e-5);
+            }
+          }
+        }
+      }
+    }
+  }
   // Test for 2x 2 square pooling layer
   void TestForwardSquare() {
     LayerParameter layer_param;
@@ -458,6 +511,112 @@ TYPED_TEST(PoolingLayerTest, TestGradientMax) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardStride2) {
+  // 3/2 and 2/2 windows, with the last column and row of windows sticking
+  // out of the image, against a brute-force reference.
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 9, 8);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  // a tie, which goes to the first maximum in row-major order
+  this->blob_bottom_->mutable_cpu_data()[1] = 10;
+  this->blob_bottom_->mutable_cpu_data()[8] = 10;
+  for (int kernel = 2; kernel <= 3; ++kernel) {
+    this->TestForwardReference(kernel, 2, PoolingParameter_PoolMethod_MAX);
+    this->TestForwardReference(kernel, 2, PoolingParameter_PoolMethod_AVE);
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestMaxStrideOverKernel) {
+  // 2/3 and 1/2 windows skip rows and columns, and the last row of windows
+  // starts past the image and stays empty.
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 9, 8);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->TestForwardReference(2, 3, PoolingParameter_PoolMethod_MAX);
+  this->TestForwardReference(1, 2, PoolingParameter_PoolMethod_MAX);
+  // Each window that has an argmax passes its diff back to it.
+  this->blob_top_vec_.resize(1);
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(2);
+  pooling_param->set_stride(3);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(4, this->blob_top_->height());
+  EXPECT_EQ(3, this->blob_top_->width());
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+      &(this->blob_bottom_vec_));
+  Dtype diff_sum = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    diff_sum += this->blob_bottom_->cpu_diff()[i];
+  }
+  EXPECT_EQ(2 * 3 * 3 * 3, diff_sum);
+}
+
+TYPED_TEST(PoolingLayerTest, TestMaxLargeWindow) {
+  // A 17x17 window has more offsets than fit in 8 bits; its maximum is at
+  // offset 16 * 17 + 16 = 288.
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(1, 2, 17, 17);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->blob_bottom_->mutable_cpu_data()[288] = 10;
+  this->blob_bottom_->mutable_cpu_data()[289 + 288] = 10;
+  for (int top_mask = 0; top_mask < 2; ++top_mask) {
+    this->blob_top_vec_.resize(1);
+    if (top_mask) {
+      this->blob_top_vec_.push_back(this->blob_top_mask_);
+    }
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_size(17);
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    for (int c = 0; c < 2; ++c) {
+      EXPECT_EQ(10, this->blob_top_->cpu_data()[c]);
+      if (top_mask) {
+        EXPECT_EQ(288, this->blob_top_mask_->cpu_data()[c]);
+      }
+    }
+    caffe_set(2, Dtype(1), this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+        &(this->blob_bottom_vec_));
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(i % 289 == 288 ? 1 : 0, this->blob_bottom_->cpu_diff()[i]);
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientMaxCompactMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  for (int kernel = 2; kernel <= 3; kernel++) {
+    for (int pad = 0; pad < kernel - 1; pad++) {
+      LayerParameter layer_param;
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_kernel_size(kernel);
+      pooling_param->set_stride(2);
+      pooling_param->set_pad(pad);
+      pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+      pooling_param->set_compact_mask(true);
+      PoolingLayer<Dtype> layer(layer_param);
+      GradientChecker<Dtype> checker(1e-4, 1e-2);
+      checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+          &(this->blob_top_vec_));
+    }
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardMaxPadded) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
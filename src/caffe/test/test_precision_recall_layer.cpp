@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class PrecisionRecallLayerTest : public ::testing::Test {
+ protected:
+  PrecisionRecallLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(50, 20, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(50, 4, 1, 1)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    // one to three distinct labels per example, padded with -1
+    Dtype* label = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < 50; ++i) {
+      const int num_labels = 1 + caffe_rng_rand() % 3;
+      for (int j = 0; j < 4; ++j) {
+        label[i * 4 + j] = j < num_labels ? (i + 7 * j) % 20 : -1;
+      }
+    }
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~PrecisionRecallLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+  }
+
+  void TestForward() {
+    const int top_k = 4;
+    LayerParameter layer_param;
+    layer_param.mutable_pr_param()->set_top_k(top_k);
+    PrecisionRecallLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    const Dtype* data = blob_bottom_data_->cpu_data();
+    const Dtype* label = blob_bottom_label_->cpu_data();
+    int ncorrect = 0, ntotal = 0;
+    for (int i = 0; i < 50; ++i) {
+      vector<std::pair<Dtype, int> > scores;
+      for (int j = 0; j < 20; ++j) {
+        scores.push_back(std::make_pair(data[i * 20 + j], j));
+      }
+      std::sort(scores.begin(), scores.end(),
+          std::greater<std::pair<Dtype, int> >());
+      for (int j = 0; j < 4 && label[i * 4 + j] != -1; ++j) {
+        ++ntotal;
+        for (int k = 0; k < top_k; ++k) {
+          if (scores[k].second == label[i * 4 + j]) {
+            ++ncorrect;
+          }
+        }
+      }
+    }
+    EXPECT_NEAR(Dtype(ncorrect) / top_k / 50, blob_top_->cpu_data()[0], 1e-6);
+    EXPECT_NEAR(Dtype(ncorrect) / ntotal, blob_top_->cpu_data()[1], 1e-6);
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PrecisionRecallLayerTest, TestDtypes);
+
+TYPED_TEST(PrecisionRecallLayerTest, TestForward) {
+  this->TestForward();
+}
+
+}  // namespace caffe
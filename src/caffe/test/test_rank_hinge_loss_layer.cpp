@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/feature_io.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RankHingeLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RankHingeLossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(6, 4, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(6, 3, 1, 1)),
+        blob_bottom_vec_label_(new Blob<Dtype>(6, 4, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_std(1);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    filler.Fill(this->blob_bottom_vec_label_);
+    // label ids, padded with -1
+    const Dtype label[] = { 0, -1, -1,
+                            0, 1, -1,
+                            2, -1, -1,
+                            1, 0, -1,
+                            1, -1, -1,
+                            2, 1, -1 };
+    caffe_copy(18, label, blob_bottom_label_->mutable_cpu_data());
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_bottom_vec_.push_back(blob_bottom_vec_label_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~RankHingeLossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_bottom_vec_label_;
+    delete blob_top_loss_;
+  }
+
+  // Normalized copy of the rows of blob.
+  vector<Dtype> Normalize(const Blob<Dtype>& blob) {
+    const int dim = blob.channels();
+    vector<Dtype> rows(blob.cpu_data(), blob.cpu_data() + blob.count());
+    for (int i = 0; i < blob.num(); ++i) {
+      Dtype nrm = 0;
+      for (int j = 0; j < dim; ++j) {
+        nrm += rows[i * dim + j] * rows[i * dim + j];
+      }
+      for (int j = 0; j < dim; ++j) {
+        rows[i * dim + j] /= sqrt(nrm);
+      }
+    }
+    return rows;
+  }
+
+  // Checks the loss and diff of a hardest-negative forward against the
+  // normalized label vectors, using only the negatives allowed by neg.
+  void CheckHardest(const vector<Dtype>& label, const bool* neg,
+      const Dtype margin) {
+    const int num = blob_bottom_data_->num();
+    const int dim = blob_bottom_data_->channels();
+    const Dtype* data = blob_bottom_data_->cpu_data();
+    const Dtype* diff = blob_bottom_data_->cpu_diff();
+    Dtype loss = 0;
+    for (int i = 0; i < num; ++i) {
+      int hardest = -1;
+      Dtype hardest_score = 0;
+      for (int k = 0; k < num; ++k) {
+        if (!neg[i * num + k]) {
+          continue;
+        }
+        Dtype score = 0;
+        for (int j = 0; j < dim; ++j) {
+          score += data[i * dim + j] * label[k * dim + j];
+        }
+        if (hardest < 0 || score > hardest_score) {
+          hardest = k;
+          hardest_score = score;
+        }
+      }
+      ASSERT_GE(hardest, 0);
+      Dtype violation = margin;
+      for (int j = 0; j < dim; ++j) {
+        violation += data[i * dim + j] *
+            (label[hardest * dim + j] - label[i * dim + j]);
+      }
+      for (int j = 0; j < dim; ++j) {
+        const Dtype expected = violation > 0 ?
+            label[hardest * dim + j] - label[i * dim + j] : 0;
+        EXPECT_NEAR(expected, diff[i * dim + j], 1e-4);
+      }
+      loss += std::max(violation, Dtype(0));
+    }
+    EXPECT_NEAR(loss / num, blob_top_loss_->cpu_data()[0], 1e-4);
+  }
+
+  // The examples allowed as negatives of each anchor, i.e., those sharing no
+  // label id with it in blob_bottom_label_.
+  static const bool* Negatives() {
+    static const bool neg[] = { 0, 0, 1, 0, 1, 1,
+                                0, 0, 1, 0, 0, 0,
+                                1, 1, 0, 1, 1, 0,
+                                0, 0, 1, 0, 0, 0,
+                                1, 0, 1, 0, 0, 0,
+                                1, 0, 0, 0, 0, 0 };
+    return neg;
+  }
+
+  // Checks a hardest-negative forward with a dictionary of three orthogonal
+  // label vectors along the first, second and last axis.
+  void TestForwardLabelDict(const string& dict_filename) {
+    LayerParameter layer_param;
+    layer_param.mutable_rank_hinge_param()->set_margin(1.);
+    layer_param.mutable_rank_hinge_param()->set_label_dict(dict_filename);
+    layer_param.mutable_rank_hinge_param()->set_negative_mining(
+        RankHingeParameter_NegativeMining_HARDEST);
+    RankHingeLossLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    // The normalized sums of the unit label vectors of each example.
+    const Dtype r = sqrt(0.5);
+    const Dtype label[] = { 1, 0, 0, 0,
+                            r, r, 0, 0,
+                            0, 0, 0, 1,
+                            r, r, 0, 0,
+                            0, 1, 0, 0,
+                            0, r, 0, r };
+    CheckHardest(vector<Dtype>(label, label + 24), Negatives(), Dtype(1.));
+  }
+
+  // Runs forward and backward with the given mining on four examples whose
+  // label vectors are the unit axes, so that example i scores data[i][k]
+  // against example k, and checks the layer picked negatives[i] for anchor
+  // i. Example i has label id labels[i]. The margin is 0.5.
+  void TestMining(const RankHingeParameter_NegativeMining mining,
+      const int* labels, const int* negatives) {
+    const Dtype data[] = { 0.5, 0.9, 0.3, -0.5,
+                           0.2, 1.0, 1.5, 0.8,
+                           -1.0, 0.0, 2.0, 0.1,
+                           0.7, 0.6, 0.0, 1.0 };
+    blob_bottom_data_->Reshape(4, 4, 1, 1);
+    blob_bottom_label_->Reshape(4, 1, 1, 1);
+    blob_bottom_vec_label_->Reshape(4, 4, 1, 1);
+    caffe_copy(16, data, blob_bottom_data_->mutable_cpu_data());
+    Dtype* label_vec = blob_bottom_vec_label_->mutable_cpu_data();
+    caffe_set(16, Dtype(0), label_vec);
+    for (int i = 0; i < 4; ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = labels[i];
+      label_vec[i * 5] = 1;
+    }
+    LayerParameter layer_param;
+    layer_param.mutable_rank_hinge_param()->set_margin(0.5);
+    layer_param.mutable_rank_hinge_param()->set_negative_mining(mining);
+    RankHingeLossLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    vector<bool> propagate_down(3, false);
+    propagate_down[0] = true;
+    layer.Backward(blob_top_vec_, propagate_down, &blob_bottom_vec_);
+    Dtype loss = 0;
+    for (int i = 0; i < 4; ++i) {
+      const int k = negatives[i];
+      const Dtype violation = 0.5 + data[i * 4 + k] - data[i * 5];
+      for (int j = 0; j < 4; ++j) {
+        const Dtype expected = violation <= 0 ? 0 :
+            Dtype(j == k) - Dtype(j == i);
+        EXPECT_NEAR(expected, blob_bottom_data_->cpu_diff()[i * 4 + j], 1e-4)
+            << "anchor " << i << " dim " << j;
+      }
+      loss += std::max(violation, Dtype(0));
+    }
+    EXPECT_NEAR(loss / 4, blob_top_loss_->cpu_data()[0], 1e-4);
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_bottom_vec_label_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RankHingeLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RankHingeLossLayerTest, TestForwardHardest) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_rank_hinge_param()->set_margin(1.);
+  layer_param.mutable_rank_hinge_param()->set_negative_mining(
+      RankHingeParameter_NegativeMining_HARDEST);
+  RankHingeLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const vector<Dtype> label_vec(this->blob_bottom_vec_label_->cpu_data(),
+      this->blob_bottom_vec_label_->cpu_data() +
+      this->blob_bottom_vec_label_->count());
+  // Run twice: the label vectors must be left untouched.
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < label_vec.size(); ++i) {
+      EXPECT_EQ(label_vec[i], this->blob_bottom_vec_label_->cpu_data()[i]);
+    }
+    this->CheckHardest(this->Normalize(*this->blob_bottom_vec_label_),
+        this->Negatives(), Dtype(1.));
+  }
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestHardestNegatives) {
+  // The highest-scoring other example, even above the positive.
+  const int labels[] = { 0, 1, 2, 3 };
+  const int negatives[] = { 1, 2, 3, 0 };
+  this->TestMining(RankHingeParameter_NegativeMining_HARDEST, labels,
+      negatives);
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestHardestNegativesSharedLabel) {
+  // Examples 0 and 1 share a label, so anchor 0 passes over example 1.
+  const int labels[] = { 0, 0, 2, 3 };
+  const int negatives[] = { 2, 2, 3, 0 };
+  this->TestMining(RankHingeParameter_NegativeMining_HARDEST, labels,
+      negatives);
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestSemiHardNegatives) {
+  // The highest-scoring other example below the positive but within the
+  // margin; anchor 2 has none and falls back to its hardest negative, which
+  // no longer violates the margin.
+  const int labels[] = { 0, 1, 2, 3 };
+  const int negatives[] = { 2, 3, 3, 0 };
+  this->TestMining(RankHingeParameter_NegativeMining_SEMI_HARD, labels,
+      negatives);
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestForwardLabelDict) {
+  // Three orthogonal, unnormalized label vectors.
+  string dict_filename;
+  MakeTempFilename(&dict_filename);
+  {
+    std::ofstream dict(dict_filename.c_str());
+    dict << "0 2 0 0 0\n1 0 3 0 0\n2 0 0 0 0.5\n";
+  }
+  this->TestForwardLabelDict(dict_filename);
+  remove(dict_filename.c_str());
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestForwardCancellingLabels) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The vectors of labels 0 and 1 sum to zero.
+  string dict_filename;
+  MakeTempFilename(&dict_filename);
+  {
+    std::ofstream dict(dict_filename.c_str());
+    dict << "0 1 0 0 0\n1 -1 0 0 0\n2 0 0 0 1\n";
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_rank_hinge_param()->set_margin(1.);
+  layer_param.mutable_rank_hinge_param()->set_label_dict(dict_filename);
+  layer_param.mutable_rank_hinge_param()->set_negative_mining(
+      RankHingeParameter_NegativeMining_HARDEST);
+  RankHingeLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  // Examples 1 and 3 carry both, and keep a zero label vector.
+  const Dtype r = sqrt(0.5);
+  const Dtype label[] = { 1, 0, 0, 0,
+                          0, 0, 0, 0,
+                          0, 0, 0, 1,
+                          0, 0, 0, 0,
+                          -1, 0, 0, 0,
+                          -r, 0, 0, r };
+  this->CheckHardest(vector<Dtype>(label, label + 24), this->Negatives(),
+      Dtype(1.));
+  remove(dict_filename.c_str());
+}
+
+TYPED_TEST(RankHingeLossLayerTest, TestForwardBinaryLabelDict) {
+  string dict_filename;
+  MakeTempFilename(&dict_filename);
+  const float vectors[] = { 2, 0, 0, 0,
+                            0, 3, 0, 0,
+                            0, 0, 0, 0.5 };
+  FeatureFileWriter writer(dict_filename, 4);
+  writer.Write(vectors, 3);
+  writer.Close();
+  this->TestForwardLabelDict(dict_filename);
+  remove(dict_filename.c_str());
+}
+
+}  // namespace caffe
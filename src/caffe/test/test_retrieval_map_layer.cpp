@@ -0,0 +1,102 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/evaluator.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class RetrievalMAPLayerTest : public ::testing::Test {
+ protected:
+  RetrievalMAPLayerTest()
+      : blob_bottom_query_(new Blob<Dtype>(6, 5, 1, 1)),
+        blob_bottom_db_(new Blob<Dtype>(6, 5, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(6, 2, 1, 1)),
+        blob_top_(new Blob<Dtype>()) {
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~RetrievalMAPLayerTest() {
+    delete blob_bottom_query_;
+    delete blob_bottom_db_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+  }
+
+  // Feeds three batches and checks the output against a Searcher run on the
+  // concatenated embeddings with the same query ids.
+  void TestForward(const bool cross_modal) {
+    const int kBatches = 3, kTopK = 4, kQueries = 5;
+    if (cross_modal) {
+      blob_bottom_vec_.push_back(blob_bottom_query_);
+    }
+    blob_bottom_vec_.push_back(blob_bottom_db_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    LayerParameter layer_param;
+    RetrievalMAPParameter* param = layer_param.mutable_retrieval_map_param();
+    param->set_num_batches(kBatches);
+    param->set_top_k(kTopK);
+    param->set_num_queries(kQueries);
+    RetrievalMAPLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    const int count = blob_bottom_db_->count();
+    vector<Dtype> query, db, label;
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int b = 0; b < kBatches; ++b) {
+      filler.Fill(blob_bottom_query_);
+      filler.Fill(blob_bottom_db_);
+      Dtype* label_data = blob_bottom_label_->mutable_cpu_data();
+      for (int i = 0; i < 6; ++i) {
+        label_data[2 * i] = caffe_rng_rand() % 3;
+        label_data[2 * i + 1] = -1;
+      }
+      const Dtype* q = (cross_modal ? blob_bottom_query_ : blob_bottom_db_)
+          ->cpu_data();
+      query.insert(query.end(), q, q + count);
+      db.insert(db.end(), blob_bottom_db_->cpu_data(),
+          blob_bottom_db_->cpu_data() + count);
+      label.insert(label.end(), label_data, label_data + 12);
+      Caffe::set_random_seed(1701);
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      if (b < kBatches - 1) {
+        EXPECT_EQ(0, blob_top_->cpu_data()[0]);
+        EXPECT_EQ(0, blob_top_->cpu_data()[1]);
+      }
+    }
+    Caffe::set_random_seed(1701);
+    evaluator::Searcher<Dtype> searcher;
+    searcher.SetupGroundTruth(kQueries, 18, 2, &label[0]);
+    searcher.Search(&query[0], &db[0], 5);
+    EXPECT_NEAR(searcher.GetMAP(NULL, kTopK) * kBatches,
+        blob_top_->cpu_data()[0], 1e-5);
+    EXPECT_NEAR(searcher.GetPrecision(NULL, kTopK) * kBatches,
+        blob_top_->cpu_data()[1], 1e-5);
+    EXPECT_GT(blob_top_->cpu_data()[1], 0);
+  }
+
+  Blob<Dtype>* const blob_bottom_query_;
+  Blob<Dtype>* const blob_bottom_db_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RetrievalMAPLayerTest, TestDtypes);
+
+TYPED_TEST(RetrievalMAPLayerTest, TestForward) {
+  this->TestForward(false);
+}
+
+TYPED_TEST(RetrievalMAPLayerTest, TestForwardCrossModal) {
+  this->TestForward(true);
+}
+
+}  // namespace caffe
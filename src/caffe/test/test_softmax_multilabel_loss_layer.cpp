@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class SoftmaxMultiLabelLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  SoftmaxMultiLabelLossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(4, 5, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(4, 3, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()),
+        blob_top_row_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_std(10);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    // label ids, padded with -1; the last example uses every slot
+    const Dtype label[] = { 0, -1, -1,
+                            1, 4, -1,
+                            3, -1, -1,
+                            2, 0, 4 };
+    caffe_copy(12, label, blob_bottom_label_->mutable_cpu_data());
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~SoftmaxMultiLabelLossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_loss_;
+    delete blob_top_row_loss_;
+  }
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_loss_;
+  Blob<Dtype>* const blob_top_row_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SoftmaxMultiLabelLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SoftmaxMultiLabelLossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_top_vec_.push_back(this->blob_top_row_loss_);
+  LayerParameter layer_param;
+  SoftmaxMultiLabelLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  const int num = 4, dim = 5;
+  const int num_labels[] = { 1, 2, 1, 3 };
+  const Dtype* data = this->blob_bottom_data_->cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  Dtype loss = 0;
+  for (int i = 0; i < num; ++i) {
+    Dtype sum = 0;
+    for (int c = 0; c < dim; ++c) {
+      sum += exp(data[i * dim + c]);
+    }
+    Dtype row_loss = 0;
+    for (int j = 0; j < num_labels[i]; ++j) {
+      const int c = static_cast<int>(label[i * 3 + j]);
+      row_loss -= log(std::max(exp(data[i * dim + c]) / sum, Dtype(FLT_MIN)));
+    }
+    row_loss /= num_labels[i];
+    EXPECT_NEAR(row_loss, this->blob_top_row_loss_->cpu_data()[i],
+        1e-4 * std::max(Dtype(1), row_loss));
+    loss += row_loss;
+  }
+  EXPECT_NEAR(loss / num, this->blob_top_loss_->cpu_data()[0],
+      1e-4 * std::max(Dtype(1), loss));
+}
+
+TYPED_TEST(SoftmaxMultiLabelLossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.add_loss_weight(3);
+  SoftmaxMultiLabelLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_), 0);
+}
+
+}  // namespace caffe
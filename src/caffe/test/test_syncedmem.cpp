@@ -68,6 +68,54 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestHostPool) {
+  void* ptr;
+  CaffeMallocHost(&ptr, 1000);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(ptr) % kCaffeHostAlignment);
+  caffe_memset(1000, 1, ptr);
+  CaffeFreeHost(ptr);
+  // A buffer of the same size class comes back from the pool.
+  const HostMemoryStats before = CaffeHostMemoryStats();
+  void* pooled_ptr;
+  CaffeMallocHost(&pooled_ptr, 990);
+  const HostMemoryStats after = CaffeHostMemoryStats();
+  EXPECT_EQ(ptr, pooled_ptr);
+  EXPECT_EQ(before.system_allocs, after.system_allocs);
+  EXPECT_EQ(before.pool_allocs + 1, after.pool_allocs);
+  EXPECT_EQ(before.bytes_pooled, after.bytes_pooled + 1024);
+  EXPECT_EQ(before.bytes_in_use + 1024, after.bytes_in_use);
+  CaffeFreeHost(pooled_ptr);
+  CaffeReleaseHostPool();
+  EXPECT_EQ(0, CaffeHostMemoryStats().bytes_pooled);
+  // A larger buffer does not fit, and the pool is empty anyway.
+  CaffeMallocHost(&ptr, 2000);
+  EXPECT_EQ(0, reinterpret_cast<size_t>(ptr) % kCaffeHostAlignment);
+  EXPECT_EQ(after.system_allocs + 1, CaffeHostMemoryStats().system_allocs);
+  CaffeFreeHost(ptr);
+}
+
+TEST_F(SyncedMemoryTest, TestHostPoolLimit) {
+  CaffeReleaseHostPool();
+  CaffeSetHostPoolLimit(4096);
+  void* small_ptr;
+  void* large_ptr;
+  CaffeMallocHost(&small_ptr, 4096);
+  CaffeMallocHost(&large_ptr, 8192);
+  // The large buffer does not fit in the pool and goes back to the system.
+  CaffeFreeHost(large_ptr);
+  EXPECT_EQ(0, CaffeHostMemoryStats().bytes_pooled);
+  CaffeFreeHost(small_ptr);
+  EXPECT_EQ(4096, CaffeHostMemoryStats().bytes_pooled);
+  // Lowering the limit trims the pool.
+  CaffeSetHostPoolLimit(0);
+  EXPECT_EQ(0, CaffeHostMemoryStats().bytes_pooled);
+  const size_t system_allocs = CaffeHostMemoryStats().system_allocs;
+  CaffeMallocHost(&small_ptr, 4096);
+  EXPECT_EQ(system_allocs + 1, CaffeHostMemoryStats().system_allocs);
+  CaffeFreeHost(small_ptr);
+  CaffeSetHostPoolLimit(kCaffeHostPoolLimit);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
@@ -0,0 +1,65 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/feature_cache.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+FeatureCache<Dtype>::FeatureCache(const string& source, const int dim)
+    : dim_(dim) {
+  CHECK_GT(dim, 0);
+  if (source.empty()) {
+    return;
+  }
+  leveldb::DB* db;
+  leveldb::Options options = GetLevelDBOptions();
+  options.create_if_missing = true;
+  LOG(INFO) << "Opening feature cache " << source;
+  leveldb::Status status = leveldb::DB::Open(options, source, &db);
+  CHECK(status.ok()) << "Failed to open leveldb " << source << std::endl
+                     << status.ToString();
+  db_.reset(db);
+}
+
+template <typename Dtype>
+bool FeatureCache<Dtype>::Get(const string& key, Dtype* feature) {
+  if (!db_) {
+    typename map<string, vector<Dtype> >::const_iterator it =
+        features_.find(key);
+    if (it == features_.end()) {
+      return false;
+    }
+    caffe_copy(dim_, &it->second[0], feature);
+    return true;
+  }
+  string value;
+  leveldb::Status status = db_->Get(leveldb::ReadOptions(), key, &value);
+  if (status.IsNotFound()) {
+    return false;
+  }
+  CHECK(status.ok()) << status.ToString();
+  CHECK_EQ(value.size(), dim_ * sizeof(Dtype))
+      << "The cached feature of " << key << " has a different size";
+  memcpy(feature, value.data(), value.size());
+  return true;
+}
+
+template <typename Dtype>
+void FeatureCache<Dtype>::Put(const string& key, const Dtype* feature) {
+  if (!db_) {
+    features_[key].assign(feature, feature + dim_);
+    return;
+  }
+  const leveldb::Slice value(reinterpret_cast<const char*>(feature),
+      dim_ * sizeof(Dtype));
+  leveldb::Status status = db_->Put(leveldb::WriteOptions(), key, value);
+  CHECK(status.ok()) << status.ToString();
+}
+
+INSTANTIATE_CLASS(FeatureCache);
+
+}  // namespace caffe
@@ -0,0 +1,232 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/feature_io.hpp"
+
+namespace caffe {
+
+// .npy magic string followed by format version 1.0.
+static const char kNpyMagic[] = "\x93NUMPY\x01\x00";
+static const int kNpyMagicSize = 8;
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff) {
+    // inf or nan
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half, or too small and rounded to zero.
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1fff;
+  // A carry out of the mantissa correctly bumps the exponent.
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return half;
+}
+
+float HalfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  int exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      // Normalize the subnormal.
+      exponent = 1;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        --exponent;
+      }
+      mantissa &= 0x3ff;
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+bool IsFeatureFile(const string& filename) {
+  char magic[6];
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  const bool is_npy = fread(magic, 1, 6, file) == 6
+      && memcmp(magic, kNpyMagic, 6) == 0;
+  fclose(file);
+  return is_npy;
+}
+
+FeatureFileWriter::FeatureFileWriter(const string& filename, const int dim,
+    const FeatureFileType type)
+    : filename_(filename), dim_(dim), num_(0), type_(type) {
+  CHECK_GT(dim_, 0);
+  file_ = fopen(filename_.c_str(), "wb");
+  CHECK(file_) << "Failed to open feature file " << filename_;
+  // Placeholder header; the row count is filled in by Close().
+  WriteHeader();
+}
+
+FeatureFileWriter::~FeatureFileWriter() {
+  Close();
+}
+
+void FeatureFileWriter::WriteHeader() {
+  char dict[kFeatureFileHeaderSize];
+  const int dict_size = kFeatureFileHeaderSize - kNpyMagicSize - 2;
+  const int written = snprintf(dict, sizeof(dict),
+      "{'descr': '%s', 'fortran_order': False, 'shape': (%d, %d), }",
+      type_ == FEATURE_FLOAT16 ? "<f2" : "<f4", num_, dim_);
+  CHECK_LT(written, dict_size);
+  // Pad with spaces up to the fixed header size and end with a newline.
+  memset(dict + written, ' ', dict_size - written);
+  dict[dict_size - 1] = '\n';
+  const uint8_t header_len[2] = { static_cast<uint8_t>(dict_size & 0xff),
+      static_cast<uint8_t>(dict_size >> 8) };
+  CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+  CHECK_EQ(fwrite(kNpyMagic, 1, kNpyMagicSize, file_), kNpyMagicSize);
+  CHECK_EQ(fwrite(header_len, 1, 2, file_), 2);
+  CHECK_EQ(fwrite(dict, 1, dict_size, file_), dict_size);
+}
+
+template <typename Dtype>
+void FeatureFileWriter::Write(const Dtype* rows, const int num) {
+  CHECK(file_) << "Feature file " << filename_ << " is closed";
+  const int count = num * dim_;
+  const float* values;
+  if (sizeof(Dtype) == sizeof(float)) {
+    values = reinterpret_cast<const float*>(rows);
+  } else {
+    float_buffer_.resize(count);
+    for (int i = 0; i < count; ++i) {
+      float_buffer_[i] = static_cast<float>(rows[i]);
+    }
+    values = &float_buffer_[0];
+  }
+  if (type_ == FEATURE_FLOAT16) {
+    half_buffer_.resize(count);
+    for (int i = 0; i < count; ++i) {
+      half_buffer_[i] = FloatToHalf(values[i]);
+    }
+    CHECK_EQ(fwrite(&half_buffer_[0], sizeof(uint16_t), count, file_), count)
+        << "Failed to write to " << filename_;
+  } else {
+    CHECK_EQ(fwrite(values, sizeof(float), count, file_), count)
+        << "Failed to write to " << filename_;
+  }
+  num_ += num;
+}
+
+template void FeatureFileWriter::Write<float>(const float* rows, const int num);
+template void FeatureFileWriter::Write<double>(const double* rows,
+    const int num);
+
+void FeatureFileWriter::Close() {
+  if (!file_) {
+    return;
+  }
+  WriteHeader();
+  CHECK_EQ(fclose(file_), 0) << "Failed to close " << filename_;
+  file_ = NULL;
+}
+
+MappedFeatureFile::MappedFeatureFile(const string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "File not found: " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0);
+  map_size_ = file_stat.st_size;
+  CHECK_GE(map_size_, kNpyMagicSize + 2) << "Truncated feature file "
+      << filename;
+  map_ = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map_ != MAP_FAILED) << "Failed to mmap " << filename;
+
+  const char* bytes = static_cast<const char*>(map_);
+  CHECK_EQ(memcmp(bytes, kNpyMagic, 6), 0) << filename
+      << " is not a feature (.npy) file";
+  CHECK_EQ(bytes[6], 1) << "Unsupported .npy version in " << filename;
+  const int header_size = kNpyMagicSize + 2
+      + (static_cast<uint8_t>(bytes[8]) | (static_cast<uint8_t>(bytes[9]) << 8));
+  CHECK_LE(header_size, map_size_);
+  const string dict(bytes + kNpyMagicSize + 2, header_size - kNpyMagicSize - 2);
+  CHECK_NE(dict.find("'fortran_order': False"), string::npos)
+      << "Feature file " << filename << " must be row-major";
+  size_t element_size;
+  if (dict.find("'descr': '<f4'") != string::npos) {
+    type_ = FEATURE_FLOAT32;
+    element_size = sizeof(float);
+  } else if (dict.find("'descr': '<f2'") != string::npos) {
+    type_ = FEATURE_FLOAT16;
+    element_size = sizeof(uint16_t);
+  } else {
+    LOG(FATAL) << "Feature file " << filename << " must be <f4 or <f2";
+  }
+  const size_t shape_pos = dict.find("'shape': (");
+  CHECK_NE(shape_pos, string::npos) << "No shape in " << filename;
+  CHECK_EQ(sscanf(dict.c_str() + shape_pos, "'shape': (%d, %d)", &num_, &dim_),
+      2) << "Feature file " << filename << " must be two dimensional";
+  payload_ = bytes + header_size;
+  CHECK_EQ(map_size_ - header_size,
+      static_cast<size_t>(num_) * dim_ * element_size)
+      << "Payload size of " << filename << " does not match its shape";
+}
+
+MappedFeatureFile::~MappedFeatureFile() {
+  munmap(map_, map_size_);
+}
+
+const float* MappedFeatureFile::data() {
+  if (type_ == FEATURE_FLOAT32) {
+    return reinterpret_cast<const float*>(payload_);
+  }
+  if (expanded_.empty() && num_ > 0) {
+    const uint16_t* halves = reinterpret_cast<const uint16_t*>(payload_);
+    const size_t count = static_cast<size_t>(num_) * dim_;
+    expanded_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      expanded_[i] = HalfToFloat(halves[i]);
+    }
+  }
+  return expanded_.empty() ? NULL : &expanded_[0];
+}
+
+}  // namespace caffe
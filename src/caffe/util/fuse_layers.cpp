@@ -0,0 +1,104 @@
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+void FuseLayers(const NetParameter& param, NetParameter* param_fused) {
+  // Initialize by copying from the input NetParameter.
+  param_fused->CopyFrom(param);
+  param_fused->clear_layers();
+  // Count the layers reading each blob, for the folds that rename a blob and
+  // so are only safe when nothing else sees it. A blob overwritten in place
+  // counts as a new blob, identified by the name and the layer writing it.
+  map<string, int> blob_name_to_last_writer;
+  map<pair<string, int>, int> blob_to_bottom_count;
+  vector<pair<string, int> > layer_to_first_bottom(param.layers_size());
+  for (int i = 0; i < param.input_size(); ++i) {
+    blob_name_to_last_writer[param.input(i)] = -1;
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      const pair<string, int> blob =
+          make_pair(blob_name, blob_name_to_last_writer[blob_name]);
+      ++blob_to_bottom_count[blob];
+      if (j == 0) {
+        layer_to_first_bottom[i] = blob;
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      blob_name_to_last_writer[layer_param.top(j)] = i;
+    }
+  }
+  // The blob names replaced by the removed layers.
+  map<string, string> blob_name_alias;
+  // The last fused layers writing and reading each blob.
+  map<string, int> blob_name_to_last_top;
+  map<string, int> blob_name_to_last_bottom;
+  for (int i = 0; i < param.layers_size(); ++i) {
+    LayerParameter layer_param(param.layers(i));
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      if (blob_name_alias.count(layer_param.bottom(j))) {
+        layer_param.set_bottom(j, blob_name_alias[layer_param.bottom(j)]);
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (blob_name_alias.count(layer_param.top(j))) {
+        layer_param.set_top(j, blob_name_alias[layer_param.top(j)]);
+      }
+    }
+    const bool single_blob =
+        layer_param.bottom_size() == 1 && layer_param.top_size() == 1;
+    const string bottom_name = single_blob ? layer_param.bottom(0) : "";
+    const string top_name = single_blob ? layer_param.top(0) : "";
+    const bool in_place = single_blob && bottom_name == top_name;
+    const bool only_reader = single_blob &&
+        blob_to_bottom_count[layer_to_first_bottom[i]] == 1;
+    if (layer_param.type() == LayerParameter_LayerType_DROPOUT &&
+        single_blob && (in_place || only_reader)) {
+      if (!in_place) {
+        blob_name_alias[top_name] = bottom_name;
+      }
+      LOG(INFO) << "Removing " << layer_param.name();
+      continue;
+    }
+    if (layer_param.type() == LayerParameter_LayerType_RELU && single_blob &&
+        layer_param.relu_param().negative_slope() >= 0 &&
+        blob_name_to_last_top.count(bottom_name)) {
+      const int producer_id = blob_name_to_last_top[bottom_name];
+      LayerParameter* producer = param_fused->mutable_layers(producer_id);
+      // The producer must be the last layer to have touched the blob, or
+      // those reading it in between would see it rectified.
+      const bool unread = !blob_name_to_last_bottom.count(bottom_name) ||
+          blob_name_to_last_bottom[bottom_name] < producer_id;
+      if ((producer->type() == LayerParameter_LayerType_CONVOLUTION ||
+           producer->type() == LayerParameter_LayerType_INNER_PRODUCT) &&
+          producer->top_size() == 1 && !producer->has_relu_param() &&
+          unread && (in_place || only_reader)) {
+        LOG(INFO) << "Fusing " << layer_param.name() << " into "
+                  << producer->name();
+        producer->mutable_relu_param()->CopyFrom(layer_param.relu_param());
+        producer->set_top(0, top_name);
+        blob_name_to_last_top.erase(bottom_name);
+        blob_name_to_last_top[top_name] = producer_id;
+        continue;
+      }
+    }
+    const int layer_id = param_fused->layers_size();
+    param_fused->add_layers()->CopyFrom(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      blob_name_to_last_bottom[layer_param.bottom(j)] = layer_id;
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      blob_name_to_last_top[layer_param.top(j)] = layer_id;
+    }
+  }
+}
+
+}  // namespace caffe
@@ -1,6 +1,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -407,4 +408,29 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <typename Dtype>
+void caffe_cpu_relu(const int n, const Dtype negative_slope, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = std::max(y[i], Dtype(0)) + negative_slope * std::min(y[i], Dtype(0));
+  }
+}
+
+template void caffe_cpu_relu<float>(const int n, const float negative_slope,
+    float* y);
+template void caffe_cpu_relu<double>(const int n, const double negative_slope,
+    double* y);
+
+template <typename Dtype>
+void caffe_cpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  for (int i = 0; i < n; ++i) {
+    dy[i] *= (y[i] > 0) + negative_slope * (y[i] <= 0);
+  }
+}
+
+template void caffe_cpu_relu_backward<float>(const int n,
+    const float negative_slope, const float* y, float* dy);
+template void caffe_cpu_relu_backward<double>(const int n,
+    const double negative_slope, const double* y, double* dy);
+
 }  // namespace caffe
@@ -336,6 +336,47 @@ void caffe_gpu_powx<double>(const int N, const double* a,
       N, a, alpha, y);
 }
 
+template <typename Dtype>
+__global__ void relu_kernel(const int n, const Dtype negative_slope,
+    Dtype* y) {
+  CUDA_KERNEL_LOOP(index, n) {
+    y[index] = y[index] > 0 ? y[index] : y[index] * negative_slope;
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype negative_slope, Dtype* y) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_kernel<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, negative_slope, y);
+}
+
+template void caffe_gpu_relu<float>(const int n, const float negative_slope,
+    float* y);
+template void caffe_gpu_relu<double>(const int n, const double negative_slope,
+    double* y);
+
+template <typename Dtype>
+__global__ void relu_backward_kernel(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  CUDA_KERNEL_LOOP(index, n) {
+    dy[index] *= (y[index] > 0) + negative_slope * (y[index] <= 0);
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_relu_backward(const int n, const Dtype negative_slope,
+    const Dtype* y, Dtype* dy) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  relu_backward_kernel<Dtype><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS>>>(
+      n, negative_slope, y, dy);
+}
+
+template void caffe_gpu_relu_backward<float>(const int n,
+    const float negative_slope, const float* y, float* dy);
+template void caffe_gpu_relu_backward<double>(const int n,
+    const double negative_slope, const double* y, double* dy);
+
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sign, y[index] = (Dtype(0) < x[index])
                                       - (x[index] < Dtype(0)));
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC(sgnbit, y[index] = signbit(x[index]));
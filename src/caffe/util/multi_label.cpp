@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/multi_label.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void MultiLabel::FromPadded(const Dtype* label, const int num,
+    const int label_dim) {
+  num_ = num;
+  max_label_ = -1;
+  offset_.resize(num + 1);
+  ids_.resize(num * label_dim);
+  int nnz = 0;
+  offset_[0] = 0;
+  for (int i = 0; i < num; ++i) {
+    const Dtype* row = label + i * label_dim;
+    for (int j = 0; j < label_dim && row[j] != -1; ++j) {
+      const int id = static_cast<int>(row[j]);
+      CHECK_GE(id, 0) << "Invalid label id " << row[j];
+      ids_[nnz++] = id;
+      max_label_ = std::max(max_label_, id);
+    }
+    std::sort(ids_.begin() + offset_[i], ids_.begin() + nnz);
+    offset_[i + 1] = nnz;
+  }
+  ids_.resize(nnz);
+  mask_.clear();
+  if (has_mask()) {
+    mask_.resize(2 * num, 0);
+    for (int i = 0; i < num; ++i) {
+      for (int k = offset_[i]; k < offset_[i + 1]; ++k) {
+        mask_[2 * i + (ids_[k] >> 6)] |= uint64_t(1) << (ids_[k] & 63);
+      }
+    }
+  }
+}
+
+template void MultiLabel::FromPadded<float>(const float* label, const int num,
+    const int label_dim);
+template void MultiLabel::FromPadded<double>(const double* label,
+    const int num, const int label_dim);
+
+bool MultiLabel::Contains(const int i, const int id) const {
+  if (id < 0 || id > max_label_) {
+    return false;
+  }
+  if (has_mask()) {
+    return (mask_[2 * i + (id >> 6)] >> (id & 63)) & 1;
+  }
+  return std::binary_search(labels(i), labels(i) + size(i), id);
+}
+
+bool MultiLabel::Shares(const int i, const int j) const {
+  if (has_mask()) {
+    return (mask_[2 * i] & mask_[2 * j])
+        || (mask_[2 * i + 1] & mask_[2 * j + 1]);
+  }
+  const int* a = labels(i);
+  const int* a_end = a + size(i);
+  const int* b = labels(j);
+  const int* b_end = b + size(j);
+  while (a < a_end && b < b_end) {
+    if (*a == *b) {
+      return true;
+    }
+    if (*a < *b) {
+      ++a;
+    } else {
+      ++b;
+    }
+  }
+  return false;
+}
+
+}  // namespace caffe
@@ -0,0 +1,128 @@
+#include "caffe/util/winograd.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void winograd_filter_transform_cpu(const Dtype* weight, const int num_output,
+    const int channels, Dtype* U) {
+  const int stride = num_output * channels;
+  for (int k = 0; k < stride; ++k) {
+    const Dtype* g = weight + k * 9;
+    // Gg: 4 x 3
+    Dtype t[4][3];
+    for (int j = 0; j < 3; ++j) {
+      t[0][j] = g[j];
+      t[1][j] = (g[j] + g[3 + j] + g[6 + j]) / 2;
+      t[2][j] = (g[j] - g[3 + j] + g[6 + j]) / 2;
+      t[3][j] = g[6 + j];
+    }
+    // (Gg)G': 4 x 4
+    for (int i = 0; i < 4; ++i) {
+      U[(i * 4 + 0) * stride + k] = t[i][0];
+      U[(i * 4 + 1) * stride + k] = (t[i][0] + t[i][1] + t[i][2]) / 2;
+      U[(i * 4 + 2) * stride + k] = (t[i][0] - t[i][1] + t[i][2]) / 2;
+      U[(i * 4 + 3) * stride + k] = t[i][2];
+    }
+  }
+}
+
+template void winograd_filter_transform_cpu<float>(const float* weight,
+    const int num_output, const int channels, float* U);
+template void winograd_filter_transform_cpu<double>(const double* weight,
+    const int num_output, const int channels, double* U);
+
+template <typename Dtype>
+void winograd_input_transform_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int tiles_h, const int tiles_w, const int ld, Dtype* V) {
+  const int stride = channels * ld;
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* im = data_im + c * height * width;
+    Dtype* v = V + c * ld;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        // the 4x4 input tile, zero-padded
+        Dtype d[4][4];
+        for (int i = 0; i < 4; ++i) {
+          const int h = th * 2 - pad_h + i;
+          for (int j = 0; j < 4; ++j) {
+            const int w = tw * 2 - pad_w + j;
+            d[i][j] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                im[h * width + w] : 0;
+          }
+        }
+        // B'd
+        Dtype t[4][4];
+        for (int j = 0; j < 4; ++j) {
+          t[0][j] = d[0][j] - d[2][j];
+          t[1][j] = d[1][j] + d[2][j];
+          t[2][j] = d[2][j] - d[1][j];
+          t[3][j] = d[1][j] - d[3][j];
+        }
+        // (B'd)B
+        const int col = th * tiles_w + tw;
+        for (int i = 0; i < 4; ++i) {
+          v[(i * 4 + 0) * stride + col] = t[i][0] - t[i][2];
+          v[(i * 4 + 1) * stride + col] = t[i][1] + t[i][2];
+          v[(i * 4 + 2) * stride + col] = t[i][2] - t[i][1];
+          v[(i * 4 + 3) * stride + col] = t[i][1] - t[i][3];
+        }
+      }
+    }
+  }
+}
+
+template void winograd_input_transform_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int tiles_h, const int tiles_w, const int ld,
+    float* V);
+template void winograd_input_transform_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int tiles_h, const int tiles_w, const int ld,
+    double* V);
+
+template <typename Dtype>
+void winograd_output_transform_cpu(const Dtype* M, const int num_output,
+    const int tiles_h, const int tiles_w, const int ld, const int height_out,
+    const int width_out, Dtype* data_out) {
+  const int stride = num_output * ld;
+  for (int c = 0; c < num_output; ++c) {
+    const Dtype* m = M + c * ld;
+    Dtype* out = data_out + c * height_out * width_out;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const int col = th * tiles_w + tw;
+        // A'm: 2 x 4
+        Dtype t[2][4];
+        for (int j = 0; j < 4; ++j) {
+          const Dtype m0 = m[j * stride + col];
+          const Dtype m1 = m[(4 + j) * stride + col];
+          const Dtype m2 = m[(8 + j) * stride + col];
+          const Dtype m3 = m[(12 + j) * stride + col];
+          t[0][j] = m0 + m1 + m2;
+          t[1][j] = m1 - m2 - m3;
+        }
+        // (A'm)A: 2 x 2
+        for (int i = 0; i < 2; ++i) {
+          const int h = th * 2 + i;
+          if (h >= height_out) {
+            break;
+          }
+          out[h * width_out + tw * 2] = t[i][0] + t[i][1] + t[i][2];
+          if (tw * 2 + 1 < width_out) {
+            out[h * width_out + tw * 2 + 1] = t[i][1] - t[i][2] - t[i][3];
+          }
+        }
+      }
+    }
+  }
+}
+
+template void winograd_output_transform_cpu<float>(const float* M,
+    const int num_output, const int tiles_h, const int tiles_w, const int ld,
+    const int height_out, const int width_out, float* data_out);
+template void winograd_output_transform_cpu<double>(const double* M,
+    const int num_output, const int tiles_h, const int tiles_w, const int ld,
+    const int height_out, const int width_out, double* data_out);
+
+}  // namespace caffe
@@ -1,11 +1,17 @@
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstring>
 #include <map>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "boost/algorithm/string.hpp"
+
 #include "caffe/caffe.hpp"
+#include "caffe/evaluator.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -31,6 +37,18 @@ DEFINE_string(weights2, "",
     "Optional; the pretrained weights for additional path, e.g., text path");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(blobs, "",
+    "Optional; comma separated feature blobs for retrieve. Defaults to the "
+    "solver's extract_feature_blob_names.");
+DEFINE_int32(num_queries, 0,
+    "Optional; the number of random queries for retrieve. Defaults to the "
+    "solver's num_queries.");
+DEFINE_int32(topk, 100,
+    "The cutoff of MAP@k and precision@k for retrieve.");
+DEFINE_bool(huge_pages, false,
+    "Optional; back large host buffers with transparent huge pages.");
+DEFINE_int32(host_pool_mb, 1024,
+    "Optional; the most memory, in MB, freed host buffers keep for reuse.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -148,6 +166,14 @@ int test() {
   Caffe::set_phase(Caffe::TEST);
   Net<float> caffe_net(FLAGS_model);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  // RETRIEVAL_MAP scales its metric for the average over the iterations.
+  for (int i = 0; i < caffe_net.layers().size(); ++i) {
+    const caffe::LayerParameter& param = caffe_net.layers()[i]->layer_param();
+    if (param.type() == caffe::LayerParameter_LayerType_RETRIEVAL_MAP) {
+      CHECK_EQ(param.retrieval_map_param().num_batches(), FLAGS_iterations)
+          << "num_batches of " << param.name() << " must equal --iterations";
+    }
+  }
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
 
   vector<Blob<float>* > bottom_vec;
@@ -197,6 +223,115 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Retrieve: extract feature blobs and evaluate retrieval among them.
+//
+// Every feature blob serves both as query source and as database, so with an
+// image and a text blob all four image/text query-database combinations are
+// evaluated. Queries are a random subset of the extracted points; a database
+// point is relevant if it shares a label with the query.
+int retrieve() {
+  caffe::SolverParameter solver_param;
+  if (FLAGS_solver.size()) {
+    caffe::ReadProtoFromTextFileOrDie(FLAGS_solver, &solver_param);
+  }
+  std::string model = FLAGS_model;
+  if (!model.size() && solver_param.test_net_size()) {
+    model = solver_param.test_net(0);
+  } else if (!model.size()) {
+    model = solver_param.net();
+  }
+  CHECK_GT(model.size(), 0) << "Need a model definition to retrieve with.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to retrieve with.";
+  vector<std::string> blob_names;
+  if (FLAGS_blobs.size()) {
+    boost::split(blob_names, FLAGS_blobs, boost::is_any_of(","));
+  } else {
+    blob_names.assign(solver_param.extract_feature_blob_names().begin(),
+        solver_param.extract_feature_blob_names().end());
+  }
+  CHECK_GT(blob_names.size(), 0) << "Need feature blobs to retrieve with.";
+  const int num_queries = FLAGS_num_queries > 0 ?
+      FLAGS_num_queries : solver_param.num_queries();
+  CHECK_GT(num_queries, 0) << "Need the number of queries.";
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  // Instantiate the caffe net.
+  Caffe::set_phase(Caffe::TEST);
+  Net<float> caffe_net(model);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  if (FLAGS_weights2.size()) {
+    caffe_net.CopyTrainedLayersFrom(FLAGS_weights2);
+  }
+  CHECK(caffe_net.has_blob("label")) << "Need a label blob to retrieve with.";
+  for (int i = 0; i < blob_names.size(); ++i) {
+    CHECK(caffe_net.has_blob(blob_names[i]))
+        << "Unknown feature blob " << blob_names[i];
+  }
+
+  // Keep the features of all iterations in memory.
+  LOG(INFO) << "Extracting features for " << FLAGS_iterations
+            << " iterations.";
+  const shared_ptr<Blob<float> > label_blob = caffe_net.blob_by_name("label");
+  vector<float> labels;
+  vector<vector<float> > features(blob_names.size());
+  vector<int> dims(blob_names.size());
+  vector<Blob<float>* > bottom_vec;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    caffe_net.Forward(bottom_vec);
+    labels.insert(labels.end(), label_blob->cpu_data(),
+        label_blob->cpu_data() + label_blob->count());
+    for (int k = 0; k < blob_names.size(); ++k) {
+      const shared_ptr<Blob<float> > feature_blob =
+          caffe_net.blob_by_name(blob_names[k]);
+      dims[k] = feature_blob->count() / feature_blob->num();
+      features[k].insert(features[k].end(), feature_blob->cpu_data(),
+          feature_blob->cpu_data() + feature_blob->count());
+    }
+  }
+  const int label_dim = label_blob->count() / label_blob->num();
+  const int num_points = labels.size() / label_dim;
+  LOG(INFO) << "Retrieving with " << num_queries << " queries among "
+            << num_points << " points.";
+  CHECK_LT(num_queries, num_points);
+
+  evaluator::Searcher<float> searcher;
+  searcher.SetupGroundTruth(num_queries, num_points, label_dim, &labels[0]);
+  for (int q = 0; q < blob_names.size(); ++q) {
+    for (int d = 0; d < blob_names.size(); ++d) {
+      if (dims[q] != dims[d]) {
+        LOG(WARNING) << "Skipping " << blob_names[q] << " -> "
+                     << blob_names[d] << ": feature dimensions differ";
+        continue;
+      }
+      searcher.Search(&features[q][0], &features[d][0], dims[d]);
+      const std::string name = blob_names[q] + " -> " + blob_names[d];
+      LOG(INFO) << name << " MAP = " << searcher.GetMAP(NULL);
+      LOG(INFO) << name << " MAP@" << FLAGS_topk << " = "
+                << searcher.GetMAP(NULL, std::min(FLAGS_topk, num_points));
+      LOG(INFO) << name << " precision@" << FLAGS_topk << " = "
+                << searcher.GetPrecision(NULL, FLAGS_topk);
+      const vector<std::pair<float, float> > curve =
+          searcher.GetPrecisionRecall();
+      std::ostringstream curve_stream;
+      for (int i = 0; i < curve.size(); ++i) {
+        curve_stream << " " << curve[i].second << ":" << curve[i].first;
+      }
+      LOG(INFO) << name << " recall:precision =" << curve_stream.str();
+    }
+  }
+  return 0;
+}
+RegisterBrewFunction(retrieve);
+
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
@@ -246,8 +381,9 @@ int time() {
       layers[i]->Reshape(bottom_vecs[i], &top_vecs[i]);
       layers[i]->Forward(bottom_vecs[i], &top_vecs[i]);
     }
+    const caffe::string& algorithm = layers[i]->algorithm();
     LOG(INFO) << layername << "\tforward: " << timer.MilliSeconds() <<
-        " milliseconds.";
+        " milliseconds." << (algorithm.empty() ? "" : " (" + algorithm + ")");
   }
   LOG(INFO) << "Forward pass: " << forward_timer.MilliSeconds() <<
       " milliseconds.";
@@ -281,10 +417,14 @@ int main(int argc, char** argv) {
       "commands:\n"
       "  train           train or finetune a model\n"
       "  test            score a model\n"
+      "  retrieve        evaluate retrieval on the extracted features\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::CaffeSetHostHugePages(FLAGS_huge_pages);
+  CHECK_GE(FLAGS_host_pool_mb, 0) << "--host_pool_mb must not be negative";
+  caffe::CaffeSetHostPoolLimit(static_cast<size_t>(FLAGS_host_pool_mb) << 20);
   if (argc == 2) {
     return GetBrewFunction(caffe::string(argv[1]))();
   } else {
@@ -1,3 +1,13 @@
+// This program computes the mean image of a lmdb/leveldb of Datum protos.
+// Usage:
+//   compute_image_mean [FLAGS] input_db output_file [db_backend]
+//
+// The main thread walks the db and hands blocks of raw records to --threads
+// workers, each of which parses its contiguous slice of the block into its own
+// integer accumulator while the main thread reads the next block. The
+// per-thread sums are merged once at the end.
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <leveldb/db.h>
 #include <lmdb.h>
@@ -5,6 +15,10 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
@@ -12,13 +26,180 @@
 using caffe::Datum;
 using caffe::BlobProto;
 using std::string;
+using std::vector;
 using std::max;
 
+DEFINE_bool(per_channel, false,
+    "Write one mean value per channel (a channels x 1 x 1 blob) instead of "
+    "the full channels x height x width mean image");
+DEFINE_int32(threads, 0,
+    "Number of threads parsing and accumulating records; 0 uses all cores");
+DEFINE_int32(subsample, 0,
+    "If positive, compute an approximate mean from about this many records "
+    "spread evenly over the db (lmdb), or the first ones (leveldb)");
+
+// Number of records each thread handles per block.
+const int kRecordsPerThread = 256;
+
+// Per-thread running sum. uint8 data is summed exactly in integers; float_data
+// falls back to double.
+struct MeanAccumulator {
+  vector<int64_t> byte_sum;
+  vector<double> float_sum;
+  int count;
+};
+
+// Sequential reader over either backend, yielding raw serialized Datums.
+class DbReader {
+ public:
+  explicit DbReader(const string& backend) : backend_(backend), valid_(false) {}
+
+  void Open(const string& source) {
+    if (backend_ == "leveldb") {
+      LOG(INFO) << "Opening leveldb " << source;
+      leveldb::Options options;
+      options.create_if_missing = false;
+      leveldb::Status status = leveldb::DB::Open(options, source, &db_);
+      CHECK(status.ok()) << "Failed to open leveldb " << source;
+      leveldb::ReadOptions read_options;
+      read_options.fill_cache = false;
+      it_ = db_->NewIterator(read_options);
+      it_->SeekToFirst();
+      valid_ = it_->Valid();
+    } else if (backend_ == "lmdb") {
+      LOG(INFO) << "Opening lmdb " << source;
+      CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS)
+          << "mdb_env_create failed";
+      CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776),
+          MDB_SUCCESS);  // 1TB
+      CHECK_EQ(mdb_env_open(mdb_env_, source.c_str(), MDB_RDONLY, 0664),
+          MDB_SUCCESS) << "mdb_env_open failed";
+      CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_),
+          MDB_SUCCESS) << "mdb_txn_begin failed";
+      CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
+          << "mdb_open failed";
+      CHECK_EQ(mdb_cursor_open(mdb_txn_, mdb_dbi_, &mdb_cursor_), MDB_SUCCESS)
+          << "mdb_cursor_open failed";
+      valid_ = mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST)
+          == MDB_SUCCESS;
+    } else {
+      LOG(FATAL) << "Unknown db backend " << backend_;
+    }
+  }
+
+  // Number of records in the db, or -1 if the backend cannot tell cheaply.
+  int64_t size() {
+    if (backend_ == "lmdb") {
+      MDB_stat stat;
+      if (mdb_stat(mdb_txn_, mdb_dbi_, &stat) == MDB_SUCCESS) {
+        return stat.ms_entries;
+      }
+    }
+    return -1;
+  }
+
+  bool valid() const { return valid_; }
+
+  void value(string* value) {
+    if (backend_ == "leveldb") {
+      value->assign(it_->value().data(), it_->value().size());
+    } else {
+      value->assign(static_cast<const char*>(mdb_value_.mv_data),
+          mdb_value_.mv_size);
+    }
+  }
+
+  void Next() {
+    if (backend_ == "leveldb") {
+      it_->Next();
+      valid_ = it_->Valid();
+    } else {
+      valid_ = mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
+          == MDB_SUCCESS;
+    }
+  }
+
+  void Close() {
+    if (backend_ == "leveldb") {
+      delete it_;
+      delete db_;
+    } else {
+      mdb_cursor_close(mdb_cursor_);
+      mdb_close(mdb_env_, mdb_dbi_);
+      mdb_txn_abort(mdb_txn_);
+      mdb_env_close(mdb_env_);
+    }
+  }
+
+ private:
+  string backend_;
+  bool valid_;
+  // leveldb
+  leveldb::DB* db_;
+  leveldb::Iterator* it_;
+  // lmdb
+  MDB_env* mdb_env_;
+  MDB_dbi mdb_dbi_;
+  MDB_val mdb_key_, mdb_value_;
+  MDB_txn* mdb_txn_;
+  MDB_cursor* mdb_cursor_;
+};
+
+// Parses records [begin, end) of the block and adds them to the accumulator.
+void AccumulateRecords(const vector<string>* records, const int begin,
+    const int end, const int data_size, MeanAccumulator* accumulator) {
+  Datum datum;
+  for (int r = begin; r < end; ++r) {
+    CHECK(datum.ParseFromString((*records)[r])) << "Failed to parse Datum";
+    const string& data = datum.data();
+    const int size_in_datum = max<int>(data.size(), datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size "
+        << size_in_datum;
+    if (data.size() != 0) {
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+      int64_t* sum = &accumulator->byte_sum[0];
+      for (int i = 0; i < data_size; ++i) {
+        sum[i] += bytes[i];
+      }
+    } else {
+      double* sum = &accumulator->float_sum[0];
+      for (int i = 0; i < data_size; ++i) {
+        sum[i] += datum.float_data(i);
+      }
+    }
+    ++accumulator->count;
+  }
+}
+
+// Splits the block into one contiguous slice per accumulator and starts a
+// thread on each. The caller joins the group.
+void StartBlock(const vector<string>& block, const int num_records,
+    const int data_size, vector<MeanAccumulator>* accumulators,
+    boost::thread_group* workers) {
+  const int num_threads = accumulators->size();
+  for (int t = 0; t < num_threads; ++t) {
+    const int begin = static_cast<int64_t>(num_records) * t / num_threads;
+    const int end = static_cast<int64_t>(num_records) * (t + 1) / num_threads;
+    workers->create_thread(boost::bind(&AccumulateRecords, &block, begin, end,
+        data_size, &(*accumulators)[t]));
+  }
+}
+
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compute the mean image of a leveldb/lmdb.\n"
+        "Usage:\n"
+        "    compute_image_mean [FLAGS] input_db output_file"
+        " [db_backend (leveldb or lmdb)]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
   if (argc < 3 || argc > 4) {
-    LOG(ERROR) << "Usage: compute_image_mean input_db output_file"
-               << " db_backend[leveldb or lmdb]";
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
 
@@ -26,145 +207,125 @@ int main(int argc, char** argv) {
   if (argc == 4) {
     db_backend = string(argv[3]);
   }
-
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.create_if_missing = false;
-  leveldb::Iterator* it = NULL;
-  // lmdb
-  MDB_env* mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_value;
-  MDB_txn* mdb_txn;
-  MDB_cursor* mdb_cursor;
-
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << argv[1];
-    leveldb::Status status = leveldb::DB::Open(
-        options, argv[1], &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << argv[1];
-    leveldb::ReadOptions read_options;
-    read_options.fill_cache = false;
-    it = db->NewIterator(read_options);
-    it->SeekToFirst();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << argv[1];
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env, argv[1], MDB_RDONLY, 0664),
-        MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed";
-    CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
-        << "mdb_cursor_open failed";
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  int num_threads = FLAGS_threads;
+  if (num_threads <= 0) {
+    num_threads = max<int>(boost::thread::hardware_concurrency(), 1);
   }
 
+  DbReader reader(db_backend);
+  reader.Open(argv[1]);
+  CHECK(reader.valid()) << "Empty db " << argv[1];
+
+  // The first datum fixes the shape.
   Datum datum;
-  BlobProto sum_blob;
+  string value;
+  reader.value(&value);
+  CHECK(datum.ParseFromString(value));
+  const int data_size = datum.channels() * datum.height() * datum.width();
+  CHECK_EQ(max<int>(datum.data().size(), datum.float_data_size()), data_size)
+      << "Incorrect data field size";
+
+  // With --subsample, take every stride-th record.
+  int64_t max_records = -1;
+  int64_t stride = 1;
+  if (FLAGS_subsample > 0) {
+    max_records = FLAGS_subsample;
+    const int64_t db_size = reader.size();
+    if (db_size > 0) {
+      stride = max<int64_t>(db_size / FLAGS_subsample, 1);
+    }
+    LOG(INFO) << "Subsampling " << max_records << " records with stride "
+              << stride;
+  }
+
+  vector<MeanAccumulator> accumulators(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    accumulators[t].byte_sum.assign(data_size, 0);
+    accumulators[t].float_sum.assign(data_size, 0.);
+    accumulators[t].count = 0;
+  }
+
+  LOG(INFO) << "Starting Iteration with " << num_threads << " threads";
+  // Double buffering: workers parse one block while the main thread reads the
+  // next one from the db.
+  const int block_size = kRecordsPerThread * num_threads;
+  vector<string> blocks[2];
+  blocks[0].resize(block_size);
+  blocks[1].resize(block_size);
+  int current = 0;
+  boost::thread_group workers;
+  bool workers_running = false;
+  int64_t read = 0;
+  int64_t last_logged = 0;
+  while (reader.valid() && read != max_records) {
+    int num_records = 0;
+    while (num_records < block_size && reader.valid() &&
+           read != max_records) {
+      reader.value(&blocks[current][num_records++]);
+      ++read;
+      for (int64_t s = 0; s < stride && reader.valid(); ++s) {
+        reader.Next();
+      }
+    }
+    if (workers_running) {
+      workers.join_all();
+    }
+    StartBlock(blocks[current], num_records, data_size, &accumulators,
+        &workers);
+    workers_running = true;
+    current = 1 - current;
+    if (read - last_logged >= 10000) {
+      LOG(ERROR) << "Processed " << read << " files.";
+      last_logged = read;
+    }
+  }
+  if (workers_running) {
+    workers.join_all();
+  }
+  reader.Close();
+
+  // Merge the per-thread sums.
+  vector<double> sum(data_size, 0.);
   int count = 0;
-  // load first datum
-  if (db_backend == "leveldb") {
-    datum.ParseFromString(it->value().ToString());
-  } else if (db_backend == "lmdb") {
-    datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  for (int t = 0; t < num_threads; ++t) {
+    for (int i = 0; i < data_size; ++i) {
+      sum[i] += accumulators[t].byte_sum[i] + accumulators[t].float_sum[i];
+    }
+    count += accumulators[t].count;
   }
+  LOG(ERROR) << "Processed " << count << " files.";
+  CHECK_GT(count, 0);
 
+  BlobProto sum_blob;
   sum_blob.set_num(1);
   sum_blob.set_channels(datum.channels());
   sum_blob.set_height(datum.height());
   sum_blob.set_width(datum.width());
-  const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
-  LOG(INFO) << "Starting Iteration";
-  if (db_backend == "leveldb") {  // leveldb
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      // just a dummy operation
-      datum.ParseFromString(it->value().ToString());
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
+  for (int i = 0; i < data_size; ++i) {
+    sum_blob.add_data(sum[i] / count);
+  }
+  if (FLAGS_per_channel) {
+    // Average the mean image over its spatial extent.
+    const int channels = sum_blob.channels();
+    const int spatial_size = sum_blob.height() * sum_blob.width();
+    BlobProto channel_blob;
+    channel_blob.set_num(1);
+    channel_blob.set_channels(channels);
+    channel_blob.set_height(1);
+    channel_blob.set_width(1);
+    for (int c = 0; c < channels; ++c) {
+      double channel_sum = 0;
+      for (int i = 0; i < spatial_size; ++i) {
+        channel_sum += sum[c * spatial_size + i];
       }
+      channel_blob.add_data(channel_sum / spatial_size / count);
+      LOG(INFO) << "mean_value channel [" << c << "]: "
+                << channel_blob.data(c);
     }
-  } else if (db_backend == "lmdb") {  // lmdb
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-    do {
-      // just a dummy operation
-      datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
-    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
-        == MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
-
-  if (count % 10000 != 0) {
-    LOG(ERROR) << "Processed " << count << " files.";
-  }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+    sum_blob.Swap(&channel_blob);
   }
   // Write to disk
   LOG(INFO) << "Write to " << argv[2];
   WriteProtoToBinaryFile(sum_blob, argv[2]);
-
-  // Clean up
-  if (db_backend == "leveldb") {
-    delete db;
-  } else if (db_backend == "lmdb") {
-    mdb_cursor_close(mdb_cursor);
-    mdb_close(mdb_env, mdb_dbi);
-    mdb_txn_abort(mdb_txn);
-    mdb_env_close(mdb_env);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
   return 0;
 }
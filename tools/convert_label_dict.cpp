@@ -0,0 +1,90 @@
+// This program compiles a text label dictionary into the binary feature file
+// format, which RankHingeLossLayer (rank_hinge_param.label_dict) mmaps instead
+// of parsing at every net setup.
+// Usage:
+//   convert_label_dict [FLAGS] TEXT_DICT BINARY_DICT
+//
+// where each line of TEXT_DICT is a label id followed by its vector:
+//   7 0.12 -0.5 ... 0.33
+// Row i of BINARY_DICT holds the vector of label id i; ids missing from
+// TEXT_DICT get a zero row.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/feature_io.hpp"
+
+using caffe::FeatureFileWriter;
+using std::string;
+using std::vector;
+
+DEFINE_bool(fp16, false,
+    "Store the vectors in half precision to halve the file size");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compile a text label dictionary for the\n"
+        "RankHingeLoss layer into a binary, mmappable one.\n"
+        "Usage:\n"
+        "    convert_label_dict [FLAGS] TEXT_DICT BINARY_DICT\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_label_dict");
+    return 1;
+  }
+
+  std::ifstream infile(argv[1]);
+  CHECK(infile.is_open()) << "Cannot open the file " << argv[1];
+  vector<vector<float> > vectors;
+  int dim = -1;
+  string line;
+  int line_id = 0;
+  while (std::getline(infile, line)) {
+    ++line_id;
+    std::istringstream fields(line);
+    int label_id;
+    if (!(fields >> label_id)) {
+      continue;  // blank line
+    }
+    CHECK_GE(label_id, 0) << "line " << line_id;
+    vector<float> vec;
+    float value;
+    while (fields >> value) {
+      vec.push_back(value);
+    }
+    if (dim < 0) {
+      dim = vec.size();
+      CHECK_GT(dim, 0) << "line " << line_id << " has no vector";
+    }
+    CHECK_EQ(vec.size(), dim) << "line " << line_id;
+    if (label_id >= vectors.size()) {
+      vectors.resize(label_id + 1);
+    }
+    CHECK(vectors[label_id].empty()) << "label id " << label_id
+        << " appears twice";
+    vectors[label_id].swap(vec);
+  }
+  CHECK_GT(dim, 0) << "Empty label dictionary " << argv[1];
+
+  FeatureFileWriter writer(argv[2], dim,
+      FLAGS_fp16 ? caffe::FEATURE_FLOAT16 : caffe::FEATURE_FLOAT32);
+  const vector<float> zeros(dim, 0);
+  for (int i = 0; i < vectors.size(); ++i) {
+    writer.Write(vectors[i].empty() ? &zeros[0] : &vectors[i][0], 1);
+  }
+  writer.Close();
+  LOG(INFO) << "Wrote " << writer.num() << " label vectors of dimension "
+      << dim << " to " << argv[2];
+  return 0;
+}
@@ -1,22 +1,158 @@
 #include <stdio.h>  // for snprintf
+#include <algorithm>
 #include <string>
 #include <vector>
-#include <stdio.h>
 
 #include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
 #include "google/protobuf/text_format.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/feature_io.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 #include "caffe/vision_layers.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
+DEFINE_string(feature_format, "text",
+    "Output format: text (one line of values per image), binary (float32 "
+    ".npy, see caffe/util/feature_io.hpp) or binary16 (float16 .npy)");
+DEFINE_int32(write_queue, 4,
+    "Number of extracted batches that may wait for the writer thread");
+DEFINE_bool(share_activations, false,
+    "Let the activations other than the extracted blobs share memory in the "
+    "TEST phase, to fit larger batches");
+
+// Copies of the feature blobs produced by one forward pass.
+template <typename Dtype>
+struct FeatureBatch {
+  int num;
+  vector<vector<Dtype> > features;
+};
+
+// Serializes completed batches on its own thread while the net computes the
+// next one. Batch buffers cycle between the free and full queues, so at most
+// --write_queue batches are in flight and no memory is allocated per batch.
+template <typename Dtype>
+class FeatureWriterThread : public InternalThread {
+ public:
+  FeatureWriterThread(const vector<string>& file_names, const vector<int>& dims,
+      const string& format, const int batch_size, const int queue_size)
+      : dims_(dims),
+        text_format_(format == "text"), num_written_(0) {
+    CHECK(text_format_ || format == "binary" || format == "binary16")
+        << "Unknown feature format " << format;
+    for (int i = 0; i < file_names.size(); ++i) {
+      LOG(INFO) << "Opening " << file_names[i];
+      if (text_format_) {
+        FILE* out = fopen(file_names[i].c_str(), "w");
+        CHECK(out) << "Failed to open " << file_names[i];
+        text_files_.push_back(out);
+      } else {
+        writers_.push_back(shared_ptr<FeatureFileWriter>(new FeatureFileWriter(
+            file_names[i], dims[i],
+            format == "binary16" ? FEATURE_FLOAT16 : FEATURE_FLOAT32)));
+      }
+    }
+    for (int b = 0; b < queue_size; ++b) {
+      FeatureBatch<Dtype>* batch = new FeatureBatch<Dtype>();
+      batch->features.resize(dims.size());
+      for (int i = 0; i < dims.size(); ++i) {
+        batch->features[i].resize(batch_size * dims[i]);
+      }
+      free_.push(batch);
+    }
+    CHECK(StartInternalThread()) << "Failed to start the writer thread";
+  }
+
+  virtual ~FeatureWriterThread() {
+    FeatureBatch<Dtype>* batch;
+    while (free_.try_pop(&batch)) {
+      delete batch;
+    }
+  }
+
+  // Blocks until a batch buffer is free.
+  FeatureBatch<Dtype>* GetFreeBatch() { return free_.pop(); }
+  void Write(FeatureBatch<Dtype>* batch) { full_.push(batch); }
+  // Flushes the pending batches, closes the files and joins the thread.
+  void Finish() {
+    full_.push(NULL);
+    CHECK(WaitForInternalThreadToExit()) << "Failed to join the writer thread";
+    for (int i = 0; i < text_files_.size(); ++i) {
+      fclose(text_files_[i]);
+    }
+    for (int i = 0; i < writers_.size(); ++i) {
+      writers_[i]->Close();
+    }
+  }
+  int num_written() const { return num_written_; }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    FeatureBatch<Dtype>* batch;
+    while ((batch = full_.pop()) != NULL) {
+      for (int i = 0; i < dims_.size(); ++i) {
+        const Dtype* rows = &batch->features[i][0];
+        if (text_format_) {
+          for (int n = 0; n < batch->num; ++n) {
+            for (int d = 0; d < dims_[i]; ++d) {
+              fprintf(text_files_[i], "%f ", rows[n * dims_[i] + d]);
+            }
+            fprintf(text_files_[i], "\n");
+          }
+        } else {
+          writers_[i]->Write(rows, batch->num);
+        }
+      }
+      const int logged = num_written_ / 1000;
+      num_written_ += batch->num;
+      if (num_written_ / 1000 != logged) {
+        LOG(ERROR)<< "Extracted features of " << num_written_ << " images";
+      }
+      free_.push(batch);
+    }
+  }
+
+  vector<int> dims_;
+  bool text_format_;
+  vector<FILE*> text_files_;
+  vector<shared_ptr<FeatureFileWriter> > writers_;
+  BlockingQueue<FeatureBatch<Dtype>*> free_;
+  BlockingQueue<FeatureBatch<Dtype>*> full_;
+  int num_written_;
+};
+
+// Returns the number of records a pass over the net's data layer produces, or
+// -1 if the net has no db-backed data layer.
+template <typename Dtype>
+int CountDatasetRecords(Net<Dtype>* net) {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net->layers();
+  for (int i = 0; i < layers.size(); ++i) {
+    // The layer counts through the database it already has open.
+    DataLayer<Dtype>* data_layer =
+        dynamic_cast<DataLayer<Dtype>*>(layers[i].get());
+    if (!data_layer) {
+      continue;
+    }
+    const int count = data_layer->NumRecords();
+    LOG(INFO) << "Data layer " << data_layer->layer_param().name() << " has "
+              << count << " records";
+    return count;
+  }
+  return -1;
+}
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -28,19 +164,27 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_write_queue, 0) << "--write_queue must be positive";
   const int num_required_args = 6;
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features  [--feature_format=text|binary|binary16]"
+    "  pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_leveldb_name1[,name2,...]  num_mini_batches  [CPU/GPU]"
     "  [DEVICE_ID=0] phase [Test/Train]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and leveldb names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and leveldbs must be equal.";
+    " and leveldbs must be equal.\n"
+    "Set num_mini_batches to 0 to make exactly one pass over the dataset of"
+    " the net's data layer.";
     return 1;
   }
   int arg_pos = num_required_args;
@@ -96,14 +240,23 @@ int feature_extraction_pipeline(int argc, char** argv) {
    }
    */
   string feature_extraction_proto(argv[++arg_pos]);
-  shared_ptr<Net<Dtype> > feature_extraction_net(
-      new Net<Dtype>(feature_extraction_proto));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
-
   string extract_feature_blob_names(argv[++arg_pos]);
   vector<string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
+  NetParameter feature_extraction_param;
+  ReadNetParamsFromTextFileOrDie(feature_extraction_proto,
+      &feature_extraction_param);
+  if (FLAGS_share_activations) {
+    feature_extraction_param.set_share_activations(true);
+    for (size_t i = 0; i < blob_names.size(); ++i) {
+      feature_extraction_param.add_keep_blob(blob_names[i]);
+    }
+  }
+  shared_ptr<Net<Dtype> > feature_extraction_net(
+      new Net<Dtype>(feature_extraction_param));
+  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+
   string save_feature_leveldb_names(argv[++arg_pos]);
   vector<string> leveldb_names;
   boost::split(leveldb_names, save_feature_leveldb_names,
@@ -118,51 +271,61 @@ int feature_extraction_pipeline(int argc, char** argv) {
         << " in the network " << feature_extraction_proto;
   }
 
-  vector<FILE*> fout;
-  for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening leveldb " << leveldb_names[i];
-    FILE* out=fopen(leveldb_names[i].c_str(), "w");
-    fout.push_back(out);
+  int num_mini_batches = atoi(argv[++arg_pos]);
+  // Rows to extract; -1 for all rows of num_mini_batches batches.
+  int num_records = -1;
+  if (num_mini_batches <= 0) {
+    num_records = CountDatasetRecords(feature_extraction_net.get());
+    CHECK_GT(num_records, 0)
+        << "num_mini_batches=0 needs a DATA or NUSWIDE_DATA layer";
   }
 
-  int num_mini_batches = atoi(argv[++arg_pos]);
+  vector<int> dims(num_features);
+  int batch_size = 0;
+  for (int i = 0; i < num_features; ++i) {
+    const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
+        ->blob_by_name(blob_names[i]);
+    if (i == 0) {
+      batch_size = feature_blob->num();
+    }
+    CHECK_EQ(feature_blob->num(), batch_size)
+        << "All feature blobs must have the same batch size";
+    dims[i] = feature_blob->count() / batch_size;
+  }
+  if (num_records > 0) {
+    num_mini_batches = (num_records + batch_size - 1) / batch_size;
+  }
+  FeatureWriterThread<Dtype> writer(leveldb_names, dims,
+      FLAGS_feature_format, batch_size, FLAGS_write_queue);
 
   LOG(ERROR)<< "Extacting Features";
 
   vector<Blob<float>*> input_vec;
-  vector<int> image_indices(num_features, 0);
+  int num_extracted = 0;
   for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
     feature_extraction_net->Forward(input_vec);
+    // The last batch of a full pass is cut at the dataset end; the data layer
+    // has already wrapped around to fill it.
+    int num = batch_size;
+    if (num_records > 0) {
+      num = std::min(batch_size, num_records - num_extracted);
+    }
+    FeatureBatch<Dtype>* batch = writer.GetFreeBatch();
+    batch->num = num;
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        feature_blob_data = feature_blob->mutable_cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          fprintf(fout[i], "%f ", feature_blob_data[d]);
-        }
-        fprintf(fout[i], "\n");
-        string value;
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-          fflush(fout[i]);
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
+      CHECK_EQ(feature_blob->count(), batch_size * dims[i])
+          << "Feature blob " << blob_names[i] << " changed its shape";
+      caffe_copy(num * dims[i], feature_blob->cpu_data(),
+          &batch->features[i][0]);
+    }
+    writer.Write(batch);
+    num_extracted += num;
   }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
+  writer.Finish();
   for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      fflush(fout[i]);
-      fclose(fout[i]);
-    }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
+    LOG(ERROR)<< "Extracted features of " << writer.num_written() <<
         " query images for feature blob " << blob_names[i];
   }
 